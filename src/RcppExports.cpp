@@ -11,26 +11,160 @@ Rcpp::Rostream<false>& Rcpp::Rcerr = Rcpp::Rcpp_cerr_get();
 #endif
 
 // fm_index_create
-List fm_index_create(CharacterVector strings, bool case_sensitive);
-RcppExport SEXP _fm_index_fm_index_create(SEXP stringsSEXP, SEXP case_sensitiveSEXP) {
+List fm_index_create(CharacterVector strings, bool case_sensitive, bool document_listing, std::string profile, Nullable<String> temp_dir, int n_threads, int n_shards, bool bidirectional, int qgram_length);
+RcppExport SEXP _fm_index_fm_index_create(SEXP stringsSEXP, SEXP case_sensitiveSEXP, SEXP document_listingSEXP, SEXP profileSEXP, SEXP temp_dirSEXP, SEXP n_threadsSEXP, SEXP n_shardsSEXP, SEXP bidirectionalSEXP, SEXP qgram_lengthSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< CharacterVector >::type strings(stringsSEXP);
     Rcpp::traits::input_parameter< bool >::type case_sensitive(case_sensitiveSEXP);
-    rcpp_result_gen = Rcpp::wrap(fm_index_create(strings, case_sensitive));
+    Rcpp::traits::input_parameter< bool >::type document_listing(document_listingSEXP);
+    Rcpp::traits::input_parameter< std::string >::type profile(profileSEXP);
+    Rcpp::traits::input_parameter< Nullable<String> >::type temp_dir(temp_dirSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< int >::type n_shards(n_shardsSEXP);
+    Rcpp::traits::input_parameter< bool >::type bidirectional(bidirectionalSEXP);
+    Rcpp::traits::input_parameter< int >::type qgram_length(qgram_lengthSEXP);
+    rcpp_result_gen = Rcpp::wrap(fm_index_create(strings, case_sensitive, document_listing, profile, temp_dir, n_threads, n_shards, bidirectional, qgram_length));
+    return rcpp_result_gen;
+END_RCPP
+}
+// fm_index_append
+List fm_index_append(const List& index, CharacterVector strings, bool case_sensitive, double merge_threshold, bool background);
+RcppExport SEXP _fm_index_fm_index_append(SEXP indexSEXP, SEXP stringsSEXP, SEXP case_sensitiveSEXP, SEXP merge_thresholdSEXP, SEXP backgroundSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const List& >::type index(indexSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type strings(stringsSEXP);
+    Rcpp::traits::input_parameter< bool >::type case_sensitive(case_sensitiveSEXP);
+    Rcpp::traits::input_parameter< double >::type merge_threshold(merge_thresholdSEXP);
+    Rcpp::traits::input_parameter< bool >::type background(backgroundSEXP);
+    rcpp_result_gen = Rcpp::wrap(fm_index_append(index, strings, case_sensitive, merge_threshold, background));
+    return rcpp_result_gen;
+END_RCPP
+}
+// fm_index_delete
+List fm_index_delete(const List& index, const NumericVector& corpus_indices);
+RcppExport SEXP _fm_index_fm_index_delete(SEXP indexSEXP, SEXP corpus_indicesSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const List& >::type index(indexSEXP);
+    Rcpp::traits::input_parameter< const NumericVector& >::type corpus_indices(corpus_indicesSEXP);
+    rcpp_result_gen = Rcpp::wrap(fm_index_delete(index, corpus_indices));
+    return rcpp_result_gen;
+END_RCPP
+}
+// fm_index_compact
+List fm_index_compact(const List& index, double max_deleted, int n_threads);
+RcppExport SEXP _fm_index_fm_index_compact(SEXP indexSEXP, SEXP max_deletedSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const List& >::type index(indexSEXP);
+    Rcpp::traits::input_parameter< double >::type max_deleted(max_deletedSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(fm_index_compact(index, max_deleted, n_threads));
     return rcpp_result_gen;
 END_RCPP
 }
 // fm_index_locate
-DataFrame fm_index_locate(const CharacterVector& patterns, const List& index);
-RcppExport SEXP _fm_index_fm_index_locate(SEXP patternsSEXP, SEXP indexSEXP) {
+DataFrame fm_index_locate(const CharacterVector& patterns, const List& index, int n_threads, CharacterVector anchor, Nullable<NumericVector> context);
+RcppExport SEXP _fm_index_fm_index_locate(SEXP patternsSEXP, SEXP indexSEXP, SEXP n_threadsSEXP, SEXP anchorSEXP, SEXP contextSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const CharacterVector& >::type patterns(patternsSEXP);
     Rcpp::traits::input_parameter< const List& >::type index(indexSEXP);
-    rcpp_result_gen = Rcpp::wrap(fm_index_locate(patterns, index));
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type anchor(anchorSEXP);
+    Rcpp::traits::input_parameter< Nullable<NumericVector> >::type context(contextSEXP);
+    rcpp_result_gen = Rcpp::wrap(fm_index_locate(patterns, index, n_threads, anchor, context));
+    return rcpp_result_gen;
+END_RCPP
+}
+// fm_index_locate_approx
+DataFrame fm_index_locate_approx(const CharacterVector& patterns, const List& index, int max_dist, CharacterVector metric, int n_threads);
+RcppExport SEXP _fm_index_fm_index_locate_approx(SEXP patternsSEXP, SEXP indexSEXP, SEXP max_distSEXP, SEXP metricSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const CharacterVector& >::type patterns(patternsSEXP);
+    Rcpp::traits::input_parameter< const List& >::type index(indexSEXP);
+    Rcpp::traits::input_parameter< int >::type max_dist(max_distSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(fm_index_locate_approx(patterns, index, max_dist, metric, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// fm_index_locate_pattern
+DataFrame fm_index_locate_pattern(const CharacterVector& patterns, const List& index, int n_threads);
+RcppExport SEXP _fm_index_fm_index_locate_pattern(SEXP patternsSEXP, SEXP indexSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const CharacterVector& >::type patterns(patternsSEXP);
+    Rcpp::traits::input_parameter< const List& >::type index(indexSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(fm_index_locate_pattern(patterns, index, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// fm_index_count
+RObject fm_index_count(const CharacterVector& patterns, const List& index, int n_threads, CharacterVector anchor);
+RcppExport SEXP _fm_index_fm_index_count(SEXP patternsSEXP, SEXP indexSEXP, SEXP n_threadsSEXP, SEXP anchorSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const CharacterVector& >::type patterns(patternsSEXP);
+    Rcpp::traits::input_parameter< const List& >::type index(indexSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type anchor(anchorSEXP);
+    rcpp_result_gen = Rcpp::wrap(fm_index_count(patterns, index, n_threads, anchor));
+    return rcpp_result_gen;
+END_RCPP
+}
+// fm_index_documents
+DataFrame fm_index_documents(const CharacterVector& patterns, const List& index, bool counts, int n_threads);
+RcppExport SEXP _fm_index_fm_index_documents(SEXP patternsSEXP, SEXP indexSEXP, SEXP countsSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const CharacterVector& >::type patterns(patternsSEXP);
+    Rcpp::traits::input_parameter< const List& >::type index(indexSEXP);
+    Rcpp::traits::input_parameter< bool >::type counts(countsSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(fm_index_documents(patterns, index, counts, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// fm_index_extract
+CharacterVector fm_index_extract(const List& index, const NumericVector& corpus_index, const IntegerVector& start, const IntegerVector& end, int n_threads);
+RcppExport SEXP _fm_index_fm_index_extract(SEXP indexSEXP, SEXP corpus_indexSEXP, SEXP startSEXP, SEXP endSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const List& >::type index(indexSEXP);
+    Rcpp::traits::input_parameter< const NumericVector& >::type corpus_index(corpus_indexSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector& >::type start(startSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector& >::type end(endSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(fm_index_extract(index, corpus_index, start, end, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// fm_index_extract_strings
+CharacterVector fm_index_extract_strings(const List& index, Nullable<NumericVector> corpus_index, int n_threads);
+RcppExport SEXP _fm_index_fm_index_extract_strings(SEXP indexSEXP, SEXP corpus_indexSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const List& >::type index(indexSEXP);
+    Rcpp::traits::input_parameter< Nullable<NumericVector> >::type corpus_index(corpus_indexSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(fm_index_extract_strings(index, corpus_index, n_threads));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -46,22 +180,32 @@ BEGIN_RCPP
 END_RCPP
 }
 // fm_index_load
-List fm_index_load(const String& path);
-RcppExport SEXP _fm_index_fm_index_load(SEXP pathSEXP) {
+List fm_index_load(const String& path, bool mmap);
+RcppExport SEXP _fm_index_fm_index_load(SEXP pathSEXP, SEXP mmapSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const String& >::type path(pathSEXP);
-    rcpp_result_gen = Rcpp::wrap(fm_index_load(path));
+    Rcpp::traits::input_parameter< bool >::type mmap(mmapSEXP);
+    rcpp_result_gen = Rcpp::wrap(fm_index_load(path, mmap));
     return rcpp_result_gen;
 END_RCPP
 }
 
 static const R_CallMethodDef CallEntries[] = {
-    {"_fm_index_fm_index_create", (DL_FUNC) &_fm_index_fm_index_create, 2},
-    {"_fm_index_fm_index_locate", (DL_FUNC) &_fm_index_fm_index_locate, 2},
+    {"_fm_index_fm_index_create", (DL_FUNC) &_fm_index_fm_index_create, 9},
+    {"_fm_index_fm_index_append", (DL_FUNC) &_fm_index_fm_index_append, 5},
+    {"_fm_index_fm_index_delete", (DL_FUNC) &_fm_index_fm_index_delete, 2},
+    {"_fm_index_fm_index_compact", (DL_FUNC) &_fm_index_fm_index_compact, 3},
+    {"_fm_index_fm_index_locate", (DL_FUNC) &_fm_index_fm_index_locate, 5},
+    {"_fm_index_fm_index_locate_approx", (DL_FUNC) &_fm_index_fm_index_locate_approx, 5},
+    {"_fm_index_fm_index_locate_pattern", (DL_FUNC) &_fm_index_fm_index_locate_pattern, 3},
+    {"_fm_index_fm_index_count", (DL_FUNC) &_fm_index_fm_index_count, 4},
+    {"_fm_index_fm_index_documents", (DL_FUNC) &_fm_index_fm_index_documents, 4},
+    {"_fm_index_fm_index_extract", (DL_FUNC) &_fm_index_fm_index_extract, 5},
+    {"_fm_index_fm_index_extract_strings", (DL_FUNC) &_fm_index_fm_index_extract_strings, 3},
     {"_fm_index_fm_index_save", (DL_FUNC) &_fm_index_fm_index_save, 2},
-    {"_fm_index_fm_index_load", (DL_FUNC) &_fm_index_fm_index_load, 1},
+    {"_fm_index_fm_index_load", (DL_FUNC) &_fm_index_fm_index_load, 2},
     {NULL, NULL, 0}
 };
 
@@ -0,0 +1,412 @@
+#ifndef FM_INDEX_APPROXIMATE_H
+#define FM_INDEX_APPROXIMATE_H
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <sdsl/suffix_array_algorithm.hpp>
+
+// Distance between a pattern and matching substrings of the corpus
+enum class Metric { hamming, levenshtein };
+
+// Suffix array range of a corpus substring within the maximum distance of
+// a pattern
+struct ApproximateRange {
+  std::uint64_t range_begin;
+  std::uint64_t n;
+  std::uint64_t length;
+  std::uint64_t distance;
+};
+
+// Finds all substrings of the text of a csa_wt within max_distance of a
+// pattern by backtracking backward search. At every suffix array range the
+// wavelet tree of the BWT lists the symbols preceding the range together
+// with their ranks, so that every branch costs a single traversal of the
+// wavelet tree. Branches exceeding the maximum distance are pruned. The
+// symbols in skip, the separator and the sentinel, are never matched.
+template<class csa_t>
+class ApproximateSearch {
+public:
+  using size_type = typename csa_t::size_type;
+  ApproximateSearch(
+    const csa_t& index, const std::string& pattern, size_type max_distance,
+    unsigned char skip
+  ) :
+    index(index), pattern(pattern), max_distance(max_distance), skip(skip)
+  {}
+  // Appends the ranges of all matches to ranges. Matches are distinct
+  // substrings, but the same text position may start several of them with
+  // the Levenshtein distance.
+  void run(Metric metric, std::vector<ApproximateRange>& ranges) {
+    run(metric, 0, index.size(), 0, 0, ranges);
+  };
+  // Only searches for matches ending with the substring of the suffix array
+  // range [begin, end), which is length long and distance away from the
+  // part of a longer pattern following this pattern
+  void run(
+    Metric metric, size_type begin, size_type end, size_type length,
+    size_type distance, std::vector<ApproximateRange>& ranges
+  );
+private:
+  const csa_t& index;
+  const std::string& pattern;
+  const size_type max_distance;
+  const unsigned char skip;
+  std::vector<ApproximateRange>* ranges = nullptr;
+  size_type base_length = 0;
+  size_type base_distance = 0;
+  // Symbols preceding a range and their ranks at both ends of the range,
+  // one buffer per depth of the search, allocated up front
+  struct Branches {
+    size_type k;
+    std::vector<typename csa_t::wavelet_tree_type::value_type> symbols;
+    std::vector<size_type> rank_begin, rank_end;
+  };
+  std::vector<Branches> branches;
+  // Rows of the edit distance matrix, one per depth of the search
+  std::vector< std::vector<size_type> > rows;
+  void allocate(size_type max_depth);
+  Branches& list_branches(size_type depth, size_type begin, size_type end);
+  void search_hamming(size_type depth, size_type begin, size_type end, size_type distance);
+  void search_levenshtein(size_type depth, size_type begin, size_type end);
+};
+
+template<class csa_t>
+void ApproximateSearch<csa_t>::run(
+  Metric metric, size_type begin, size_type end, size_type length,
+  size_type distance, std::vector<ApproximateRange>& ranges_
+) {
+  ranges = &ranges_;
+  base_length = length;
+  base_distance = distance;
+  if (metric == Metric::hamming) {
+    allocate(pattern.size());
+    search_hamming(0, begin, end, 0);
+    return;
+  }
+  // Matches are at most max_distance longer than the pattern. Entry j of a
+  // row is the distance of the last j pattern characters to the text
+  // matched so far.
+  allocate(pattern.size() + max_distance);
+  rows.assign(pattern.size() + max_distance + 1, std::vector<size_type>(pattern.size() + 1));
+  for (size_type j = 0; j <= pattern.size(); j++)
+    rows[0][j] = j;
+  // Without extending, the pattern can only be deleted as a whole
+  if (base_length > 0 && pattern.size() <= max_distance)
+    ranges->push_back({begin, end - begin, base_length, base_distance + pattern.size()});
+  search_levenshtein(0, begin, end);
+}
+
+template<class csa_t>
+void ApproximateSearch<csa_t>::allocate(size_type max_depth) {
+  const auto sigma = index.wavelet_tree.sigma;
+  branches.resize(max_depth);
+  for (auto& x: branches) {
+    x.symbols.resize(sigma);
+    x.rank_begin.resize(sigma);
+    x.rank_end.resize(sigma);
+  }
+}
+
+template<class csa_t>
+typename ApproximateSearch<csa_t>::Branches& ApproximateSearch<csa_t>::list_branches(
+  size_type depth, size_type begin, size_type end
+) {
+  auto& x = branches[depth];
+  index.wavelet_tree.interval_symbols(begin, end, x.k, x.symbols, x.rank_begin, x.rank_end);
+  return x;
+}
+
+// The pattern is matched from its end, depth characters are matched so far.
+// With the maximum distance reached, only exact matches of the rest are left.
+template<class csa_t>
+void ApproximateSearch<csa_t>::search_hamming(
+  size_type depth, size_type begin, size_type end, size_type distance
+) {
+  const size_type m = pattern.size();
+  if (distance == max_distance) {
+    size_type l, r;
+    const auto n = sdsl::backward_search(
+      index, begin, end - 1, pattern.begin(), pattern.end() - depth, l, r
+    );
+    if (n > 0)
+      ranges->push_back({l, n, base_length + m, base_distance + distance});
+    return;
+  }
+  if (depth == m) {
+    ranges->push_back({begin, end - begin, base_length + m, base_distance + distance});
+    return;
+  }
+  const auto expected = static_cast<unsigned char>(pattern[m - depth - 1]);
+  auto& x = list_branches(depth, begin, end);
+  for (size_type i = 0; i < x.k; i++) {
+    const auto c = x.symbols[i];
+    if (c == 0 || c == skip)
+      continue;
+    const auto c_begin = index.C[index.char2comp[c]];
+    search_hamming(
+      depth + 1, c_begin + x.rank_begin[i], c_begin + x.rank_end[i],
+      distance + (c != expected)
+    );
+  }
+}
+
+// Extends the text matched so far by one character to the left for every
+// branch, computing the next row of the edit distance matrix. A match is
+// reported whenever the whole pattern is within the maximum distance, and
+// the search continues as long as any part of the pattern is.
+template<class csa_t>
+void ApproximateSearch<csa_t>::search_levenshtein(size_type depth, size_type begin, size_type end) {
+  const size_type m = pattern.size();
+  if (depth == m + max_distance)
+    return;
+  auto& x = list_branches(depth, begin, end);
+  for (size_type i = 0; i < x.k; i++) {
+    const auto c = x.symbols[i];
+    if (c == 0 || c == skip)
+      continue;
+    const auto& row = rows[depth];
+    auto& next = rows[depth + 1];
+    next[0] = depth + 1;
+    size_type min_distance = next[0];
+    for (size_type j = 1; j <= m; j++) {
+      const bool mismatch = static_cast<unsigned char>(pattern[m - j]) != c;
+      next[j] = std::min({row[j - 1] + mismatch, row[j] + 1, next[j - 1] + 1});
+      min_distance = std::min(min_distance, next[j]);
+    }
+    if (min_distance > max_distance)
+      continue;
+    const auto c_begin = index.C[index.char2comp[c]];
+    const auto next_begin = c_begin + x.rank_begin[i], next_end = c_begin + x.rank_end[i];
+    if (next[m] <= max_distance)
+      ranges->push_back({
+        next_begin, next_end - next_begin, base_length + depth + 1,
+        base_distance + next[m]
+      });
+    search_levenshtein(depth + 1, next_begin, next_end);
+  }
+}
+
+// Range of a substring in the suffix arrays of a text and of the reversed
+// text, which are always of the same size
+struct BidirectionalRange {
+  std::uint64_t begin;
+  std::uint64_t reverse_begin;
+  std::uint64_t n;
+};
+
+// Extensions of a substring by one character. index is the csa_wt of the
+// text in which the substring is extended to the left and reverse the one
+// of the reversed text, swap them for extending to the right. Symbols
+// preceding the range in the BWT of index give the new range in index. In
+// reverse, the substring followed by any symbol sorts in the order of the
+// symbols, so the new range follows the occurrences of all smaller symbols.
+// This does not need lexicographically ordered wavelet trees, unlike
+// sdsl::bidirectional_search.
+template<class csa_t>
+class RangeExtensions {
+public:
+  using size_type = typename csa_t::size_type;
+  using value_type = typename csa_t::wavelet_tree_type::value_type;
+  RangeExtensions() {};
+  RangeExtensions(const csa_t& index) :
+    symbols(index.wavelet_tree.sigma), rank_begin(index.wavelet_tree.sigma),
+    rank_end(index.wavelet_tree.sigma), order(index.wavelet_tree.sigma)
+  {};
+  // Lists the extensions of range, with index in the role of the forward
+  // index
+  void list(const csa_t& index, const BidirectionalRange& range) {
+    index.wavelet_tree.interval_symbols(
+      range.begin, range.begin + range.n, k, symbols, rank_begin, rank_end
+    );
+    for (size_type i = 0; i < k; i++)
+      order[i] = i;
+    std::sort(order.begin(), order.begin() + k, [&](size_type a, size_type b) {
+      return symbols[a] < symbols[b];
+    });
+    reverse_begin = range.reverse_begin;
+    this->index = &index;
+  };
+  size_type size() const { return k; };
+  // The i-th extension in ascending order of symbols
+  value_type symbol(size_type i) const { return symbols[order[i]]; };
+  BidirectionalRange range(size_type i) {
+    const auto j = order[i];
+    const auto c_begin = index->C[index->char2comp[symbols[j]]];
+    const BidirectionalRange extended = {
+      c_begin + rank_begin[j], reverse_begin, rank_end[j] - rank_begin[j]
+    };
+    reverse_begin += extended.n;
+    return extended;
+  };
+private:
+  const csa_t* index = nullptr;
+  size_type k = 0;
+  std::vector<value_type> symbols;
+  std::vector<size_type> rank_begin, rank_end, order;
+  size_type reverse_begin = 0;
+};
+
+// Approximate search with the indices of the text and of the reversed text,
+// using the pigeonhole search scheme: of max_distance + 1 pieces of the
+// pattern, at least one matches exactly. For every piece, one search
+// matches it exactly, which quickly narrows down the ranges, then extends
+// to the right over the rest of the pattern with up to max_distance
+// errors, and then to the left with the errors left. This explores far
+// fewer ranges than backtracking from the end of the pattern, which has to
+// branch from the first character on. Matches with errors in several
+// pieces are found by several searches.
+template<class csa_t>
+class SchemeSearch {
+public:
+  using size_type = typename csa_t::size_type;
+  SchemeSearch(
+    const csa_t& index, const csa_t& reverse, const std::string& pattern,
+    size_type max_distance, unsigned char skip
+  ) :
+    index(index), reverse(reverse), pattern(pattern),
+    max_distance(max_distance), skip(skip)
+  {}
+  // Needs at least one character per piece
+  static bool applicable(const std::string& pattern, size_type max_distance) {
+    return max_distance > 0 && pattern.size() > max_distance;
+  };
+  void run(Metric metric, std::vector<ApproximateRange>& ranges);
+private:
+  const csa_t& index;
+  const csa_t& reverse;
+  const std::string& pattern;
+  const size_type max_distance;
+  const unsigned char skip;
+  Metric metric;
+  std::vector<ApproximateRange>* ranges = nullptr;
+  // The part of the pattern left of the current piece
+  std::string prefix;
+  // The part right of it, matched with rows of the edit distance matrix
+  // for the Levenshtein distance
+  std::string suffix;
+  std::vector< RangeExtensions<csa_t> > extensions;
+  std::vector< std::vector<size_type> > rows;
+  void search_piece(size_type piece_begin, size_type piece_end);
+  void extend_right(size_type depth, const BidirectionalRange& range, size_type distance);
+  void extend_levenshtein(size_type depth, const BidirectionalRange& range);
+  void extend_left(const BidirectionalRange& range, size_type length, size_type distance);
+};
+
+template<class csa_t>
+void SchemeSearch<csa_t>::run(Metric metric_, std::vector<ApproximateRange>& ranges_) {
+  metric = metric_;
+  ranges = &ranges_;
+  const size_type m = pattern.size(), n_pieces = max_distance + 1;
+  extensions.assign(m + max_distance + 1, RangeExtensions<csa_t>(reverse));
+  for (size_type i = 0; i < n_pieces; i++)
+    search_piece(i * m / n_pieces, (i + 1) * m / n_pieces);
+}
+
+template<class csa_t>
+void SchemeSearch<csa_t>::search_piece(size_type piece_begin, size_type piece_end) {
+  // The piece is matched exactly, one backward search step per character
+  // in each index. The reversed text contains the piece reversed, which is
+  // searched from the start of the piece.
+  size_type begin, end, reverse_begin, reverse_end;
+  const auto n = sdsl::backward_search(
+    index, 0, index.size() - 1, pattern.begin() + piece_begin,
+    pattern.begin() + piece_end, begin, end
+  );
+  if (n == 0)
+    return;
+  sdsl::backward_search(
+    reverse, 0, reverse.size() - 1, pattern.rbegin() + (pattern.size() - piece_end),
+    pattern.rbegin() + (pattern.size() - piece_begin), reverse_begin, reverse_end
+  );
+  const BidirectionalRange range = {begin, reverse_begin, n};
+  prefix = pattern.substr(0, piece_begin);
+  suffix = pattern.substr(piece_end);
+  const auto piece_length = piece_end - piece_begin;
+  if (metric == Metric::hamming) {
+    extend_right(0, range, 0);
+    return;
+  }
+  const size_type m = suffix.size();
+  rows.assign(m + max_distance + 1, std::vector<size_type>(m + 1));
+  for (size_type j = 0; j <= m; j++)
+    rows[0][j] = j;
+  if (m <= max_distance)
+    extend_left(range, piece_length, m);
+  extend_levenshtein(0, range);
+}
+
+// depth characters of the suffix are matched, with distance mismatches
+template<class csa_t>
+void SchemeSearch<csa_t>::extend_right(
+  size_type depth, const BidirectionalRange& range, size_type distance
+) {
+  if (depth == suffix.size()) {
+    extend_left(range, pattern.size() - prefix.size(), distance);
+    return;
+  }
+  const auto expected = static_cast<unsigned char>(suffix[depth]);
+  auto& x = extensions[depth];
+  // Extending to the right is extending to the left in the reversed text
+  x.list(reverse, {range.reverse_begin, range.begin, range.n});
+  for (size_type i = 0; i < x.size(); i++) {
+    const auto c = x.symbol(i);
+    const auto extended = x.range(i);
+    if (c == 0 || c == skip)
+      continue;
+    const auto extended_distance = distance + (c != expected);
+    if (extended_distance <= max_distance) {
+      extend_right(
+        depth + 1, {extended.reverse_begin, extended.begin, extended.n},
+        extended_distance
+      );
+    }
+  }
+}
+
+// The substring of range is depth characters longer than the piece, rows
+// holds the distances of prefixes of the suffix to these characters
+template<class csa_t>
+void SchemeSearch<csa_t>::extend_levenshtein(size_type depth, const BidirectionalRange& range) {
+  const size_type m = suffix.size();
+  if (depth == m + max_distance)
+    return;
+  const auto piece_length = pattern.size() - prefix.size() - m;
+  auto& x = extensions[depth];
+  x.list(reverse, {range.reverse_begin, range.begin, range.n});
+  for (size_type i = 0; i < x.size(); i++) {
+    const auto c = x.symbol(i);
+    const auto extended_ = x.range(i);
+    if (c == 0 || c == skip)
+      continue;
+    const BidirectionalRange extended = {extended_.reverse_begin, extended_.begin, extended_.n};
+    const auto& row = rows[depth];
+    auto& next = rows[depth + 1];
+    next[0] = depth + 1;
+    size_type min_distance = next[0];
+    for (size_type j = 1; j <= m; j++) {
+      const bool mismatch = static_cast<unsigned char>(suffix[j - 1]) != c;
+      next[j] = std::min({row[j - 1] + mismatch, row[j] + 1, next[j - 1] + 1});
+      min_distance = std::min(min_distance, next[j]);
+    }
+    if (min_distance > max_distance)
+      continue;
+    if (next[m] <= max_distance)
+      extend_left(extended, piece_length + depth + 1, next[m]);
+    extend_levenshtein(depth + 1, extended);
+  }
+}
+
+// Matches the prefix with the errors left, only the range in the index of
+// the text is needed from here on
+template<class csa_t>
+void SchemeSearch<csa_t>::extend_left(
+  const BidirectionalRange& range, size_type length, size_type distance
+) {
+  ApproximateSearch<csa_t>(index, prefix, max_distance - distance, skip).run(
+    metric, range.begin, range.begin + range.n, length, distance, *ranges
+  );
+}
+
+#endif
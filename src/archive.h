@@ -0,0 +1,217 @@
+#ifndef FM_INDEX_ARCHIVE_H
+#define FM_INDEX_ARCHIVE_H
+
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include <sdsl/memory_management.hpp>
+#include <sdsl/util.hpp>
+#include <cereal/cereal.hpp>
+
+// Binary cereal archives for index files. They store values like
+// cereal::BinaryOutputArchive, but every block of binary data (the payload of
+// an sdsl::int_vector) starts at an offset divisible by 8 and is followed by
+// 8 zero bytes, as sdsl support structures may read one word past the end of
+// a vector. When the whole file is mapped into memory, these blocks can then
+// be used in place instead of being copied to the heap.
+//
+// Offsets are relative to the start of the archive, which therefore has to be
+// aligned to 8 bytes in the file as well.
+const std::size_t archive_alignment = 8;
+
+inline std::size_t archive_padding(std::uint64_t offset) {
+  return (archive_alignment - offset % archive_alignment) % archive_alignment;
+}
+
+namespace cereal {
+
+class AlignedOutputArchive : public OutputArchive<AlignedOutputArchive, AllowEmptyClassElision> {
+public:
+  AlignedOutputArchive(std::ostream& stream) :
+    OutputArchive<AlignedOutputArchive, AllowEmptyClassElision>(this),
+    stream(stream)
+  {}
+
+  void saveBinary(const void* data, std::streamsize size) {
+    auto written = stream.rdbuf()->sputn(reinterpret_cast<const char*>(data), size);
+    if (written != size)
+      throw Exception("Failed to write " + std::to_string(size) + " bytes to output stream");
+    offset += size;
+  }
+
+  void saveAligned(const void* data, std::streamsize size) {
+    static const char zeros[archive_alignment] = {};
+    saveBinary(zeros, archive_padding(offset));
+    saveBinary(data, size);
+    saveBinary(zeros, archive_alignment);
+  }
+
+private:
+  std::ostream& stream;
+  std::uint64_t offset = 0;
+};
+
+// Reads either from a stream, copying all data, or from memory that outlives
+// every object loaded from it, in which case borrow_binary() hands out
+// pointers to binary blocks instead.
+class AlignedInputArchive : public InputArchive<AlignedInputArchive, AllowEmptyClassElision> {
+public:
+  AlignedInputArchive(std::istream& stream) :
+    InputArchive<AlignedInputArchive, AllowEmptyClassElision>(this),
+    stream(&stream)
+  {}
+
+  AlignedInputArchive(const char* begin, const char* end) :
+    InputArchive<AlignedInputArchive, AllowEmptyClassElision>(this),
+    begin(begin), end(end)
+  {}
+
+  void loadBinary(void* data, std::streamsize size) {
+    if (stream) {
+      auto read = stream->rdbuf()->sgetn(reinterpret_cast<char*>(data), size);
+      if (read != size)
+        throw Exception("Failed to read " + std::to_string(size) + " bytes from input stream");
+    } else {
+      std::memcpy(data, take(size), size);
+    }
+    offset += size;
+  }
+
+  void loadAligned(void* data, std::streamsize size) {
+    skip(archive_padding(offset));
+    loadBinary(data, size);
+    skip(archive_alignment);
+  }
+
+  // Returns a pointer to the next binary block of the given size and skips
+  // over it, or nullptr when reading from a stream.
+  const void* borrow_binary(std::size_t size) {
+    if (stream)
+      return nullptr;
+    skip(archive_padding(offset));
+    const char* data = take(size);
+    offset += size;
+    skip(archive_alignment);
+    return data;
+  }
+
+private:
+  const char* take(std::size_t size) {
+    if (static_cast<std::uint64_t>(end - begin) < offset + size)
+      throw Exception("Failed to read " + std::to_string(size) + " bytes, unexpected end of file");
+    return begin + offset;
+  }
+
+  void skip(std::size_t size) {
+    char padding[archive_alignment];
+    loadBinary(padding, size);
+  }
+
+  std::istream* stream = nullptr;
+  const char* begin = nullptr;
+  const char* end = nullptr;
+  std::uint64_t offset = 0;
+};
+
+template<class T> inline
+typename std::enable_if<std::is_arithmetic<T>::value, void>::type
+CEREAL_SAVE_FUNCTION_NAME(AlignedOutputArchive& ar, const T& t) {
+  ar.saveBinary(std::addressof(t), sizeof(t));
+}
+
+template<class T> inline
+typename std::enable_if<std::is_arithmetic<T>::value, void>::type
+CEREAL_LOAD_FUNCTION_NAME(AlignedInputArchive& ar, T& t) {
+  ar.loadBinary(std::addressof(t), sizeof(t));
+}
+
+template<class Archive, class T> inline
+CEREAL_ARCHIVE_RESTRICT(AlignedInputArchive, AlignedOutputArchive)
+CEREAL_SERIALIZE_FUNCTION_NAME(Archive& ar, NameValuePair<T>& t) {
+  ar(t.value);
+}
+
+template<class Archive, class T> inline
+CEREAL_ARCHIVE_RESTRICT(AlignedInputArchive, AlignedOutputArchive)
+CEREAL_SERIALIZE_FUNCTION_NAME(Archive& ar, SizeTag<T>& t) {
+  ar(t.size);
+}
+
+// Fixed size C arrays are written with binary_data() but read element by
+// element (cereal/types/common.hpp), so only blocks behind a pointer, as used
+// by int_vector and std::vector, are aligned.
+template<class T>
+using is_aligned_block = std::is_pointer<typename std::remove_reference<T>::type>;
+
+template<class T> inline
+typename std::enable_if<is_aligned_block<T>::value, void>::type
+CEREAL_SAVE_FUNCTION_NAME(AlignedOutputArchive& ar, const BinaryData<T>& bd) {
+  ar.saveAligned(bd.data, static_cast<std::streamsize>(bd.size));
+}
+
+template<class T> inline
+typename std::enable_if<!is_aligned_block<T>::value, void>::type
+CEREAL_SAVE_FUNCTION_NAME(AlignedOutputArchive& ar, const BinaryData<T>& bd) {
+  ar.saveBinary(bd.data, static_cast<std::streamsize>(bd.size));
+}
+
+template<class T> inline
+typename std::enable_if<is_aligned_block<T>::value, void>::type
+CEREAL_LOAD_FUNCTION_NAME(AlignedInputArchive& ar, BinaryData<T>& bd) {
+  ar.loadAligned(bd.data, static_cast<std::streamsize>(bd.size));
+}
+
+template<class T> inline
+typename std::enable_if<!is_aligned_block<T>::value, void>::type
+CEREAL_LOAD_FUNCTION_NAME(AlignedInputArchive& ar, BinaryData<T>& bd) {
+  ar.loadBinary(bd.data, static_cast<std::streamsize>(bd.size));
+}
+
+} // namespace cereal
+
+CEREAL_REGISTER_ARCHIVE(cereal::AlignedOutputArchive)
+CEREAL_REGISTER_ARCHIVE(cereal::AlignedInputArchive)
+CEREAL_SETUP_ARCHIVE_TRAITS(cereal::AlignedInputArchive, cereal::AlignedOutputArchive)
+
+// Read-only mapping of a whole file. The mapping is registered with
+// sdsl::memory_manager, so int_vectors pointing into it never free it.
+class MappedFile {
+public:
+  MappedFile(std::string path) {
+    size_ = sdsl::util::file_size(path);
+    fd = sdsl::memory_manager::open_file_for_mmap(path, std::ios_base::in);
+    if (fd < 0)
+      throw std::runtime_error("Could not open file " + path);
+    data_ = static_cast<const char*>(sdsl::memory_manager::mmap_file(fd, size_, std::ios_base::in));
+    if (data_ == nullptr) {
+      sdsl::memory_manager::close_file_for_mmap(fd);
+      throw std::runtime_error("Could not map file " + path + " into memory");
+    }
+    sdsl::memory_manager::register_borrowed(data_, size_);
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() {
+    sdsl::memory_manager::unregister_borrowed(data_);
+    sdsl::memory_manager::mem_unmap(fd, const_cast<char*>(data_), size_);
+    sdsl::memory_manager::close_file_for_mmap(fd);
+  }
+
+  const char* data() const { return data_; }
+  std::uint64_t size() const { return size_; }
+
+private:
+  int fd = -1;
+  const char* data_ = nullptr;
+  std::uint64_t size_ = 0;
+};
+
+#endif
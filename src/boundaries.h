@@ -0,0 +1,73 @@
+#ifndef FM_INDEX_BOUNDARIES_H
+#define FM_INDEX_BOUNDARIES_H
+
+#include <vector>
+
+#include <sdsl/sd_vector.hpp>
+
+// Start positions of all corpus strings within the concatenated text, stored
+// as an Elias-Fano coded bit vector marking every start position. The string
+// containing a text position is found by a rank query, the start of a string
+// by a select query.
+class DocumentBoundaries {
+public:
+  using size_type = sdsl::sd_vector<>::size_type;
+  DocumentBoundaries() { init_support(); };
+  DocumentBoundaries(const std::vector<size_type>& starts, size_type text_size);
+  DocumentBoundaries(const DocumentBoundaries& other) : starts(other.starts) { init_support(); };
+  DocumentBoundaries& operator=(const DocumentBoundaries& other);
+  // Number of corpus strings
+  size_type size() const { return n_documents; };
+  // Length of the concatenated text
+  size_type text_size() const { return starts.size(); };
+  // 0-based index of the corpus string containing text position pos
+  size_type document(size_type pos) const { return starts_rank(pos + 1) - 1; };
+  // Text position of the first character of corpus string doc
+  size_type start(size_type doc) const { return starts_select(doc + 1); };
+  // Text position one past the end of corpus string doc, including its
+  // trailing separator
+  size_type end(size_type doc) const {
+    return doc + 1 < n_documents ? start(doc + 1) : text_size();
+  };
+  template<class Archive>
+  void save(Archive& archive) const {
+    archive(starts);
+  };
+  template<class Archive>
+  void load(Archive& archive) {
+    archive(starts);
+    init_support();
+  };
+private:
+  void init_support();
+  sdsl::sd_vector<> starts;
+  sdsl::sd_vector<>::rank_1_type starts_rank;
+  sdsl::sd_vector<>::select_1_type starts_select;
+  size_type n_documents = 0;
+};
+
+inline DocumentBoundaries::DocumentBoundaries(
+  const std::vector<size_type>& starts_, size_type text_size
+) {
+  sdsl::sd_vector_builder builder(text_size, starts_.size());
+  for (const auto& x: starts_)
+    builder.set(x);
+  starts = sdsl::sd_vector<>(builder);
+  init_support();
+}
+
+inline DocumentBoundaries& DocumentBoundaries::operator=(const DocumentBoundaries& other) {
+  if (this != &other) {
+    starts = other.starts;
+    init_support();
+  }
+  return *this;
+}
+
+inline void DocumentBoundaries::init_support() {
+  sdsl::util::init_support(starts_rank, &starts);
+  sdsl::util::init_support(starts_select, &starts);
+  n_documents = starts.size() > 0 ? starts_rank(starts.size()) : 0;
+}
+
+#endif
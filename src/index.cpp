@@ -1,9 +1,23 @@
 #include <string>
 #include <vector>
+#include <cstdio>
+#include <exception>
 #include <fstream>
+#include <atomic>
+#include <climits>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <unordered_set>
 
 #include <sdsl/suffix_arrays.hpp>
+#include <sdsl/rmq_support.hpp>
 #include <sdsl/cereal.hpp>
+#include <cereal/types/string.hpp>
 
 // Realloc is defined in both the cereal dependency rapidjson and in core R
 // Have to include Rcpp after sdsl / cereal
@@ -11,105 +25,2213 @@
 
 #include <stringi.h>
 
+#include "approximate.h"
+#include "archive.h"
+#include "boundaries.h"
+#include "parallel.h"
+#include "pattern.h"
+#include "phi.h"
+#include "qgrams.h"
+#include "tombstones.h"
+
 using namespace Rcpp;
 
-using tree_t = sdsl::csa_wt<>;
+// Appended to every corpus string before concatenation so that no pattern
+// can match across two neighbouring strings. Not allowed in the corpus.
+const char document_separator = '\x01';
+
+// Patterns containing the separator could only ever match across strings
+bool is_searchable(const std::string& pattern) {
+  return !pattern.empty() && pattern.find(document_separator) == std::string::npos;
+}
+
+// Integer result vector that is filled from worker threads. Values beyond the
+// range of R integers are stored as doubles, which represent them exactly up
+// to 2^53. Lengths beyond 2^31 - 1 become R long vectors.
+class IndexVector {
+public:
+  IndexVector(R_xlen_t n, std::uint64_t max_value) : is_double(max_value > INT_MAX) {
+    if (is_double) {
+      doubles = NumericVector(n);
+      doubles_ = doubles.begin();
+    } else {
+      integers = IntegerVector(n);
+      integers_ = integers.begin();
+    }
+  };
+  void set(size_t i, std::uint64_t value) {
+    if (is_double)
+      doubles_[i] = value;
+    else
+      integers_[i] = value;
+  };
+  void copy(size_t from, size_t to) {
+    if (is_double)
+      doubles_[to] = doubles_[from];
+    else
+      integers_[to] = integers_[from];
+  };
+  // Keeps only the first n values
+  void truncate(R_xlen_t n) {
+    if (is_double) {
+      doubles = NumericVector(doubles.begin(), doubles.begin() + n);
+      doubles_ = doubles.begin();
+    } else {
+      integers = IntegerVector(integers.begin(), integers.begin() + n);
+      integers_ = integers.begin();
+    }
+  };
+  RObject get() const {
+    return is_double ? wrap(doubles) : wrap(integers);
+  };
+private:
+  bool is_double;
+  IntegerVector integers;
+  NumericVector doubles;
+  int* integers_ = nullptr;
+  double* doubles_ = nullptr;
+};
+
+// Index files start with this tag followed by the file format version
+const char file_magic[8] = {'F', 'M', 'I', 'N', 'D', 'E', 'X', '\0'};
+const std::uint32_t file_format_version = 11;
+
+// Index profiles trade memory for the speed of locating matches. Profile ids
+// are stored in index files and must not change.
+enum class Profile : std::uint32_t { standard = 0, fast = 1, small = 2, repetitive = 3 };
+const char* const profile_names[] = {"default", "fast", "small", "repetitive"};
+
+// Huffman shaped wavelet tree, every 32nd suffix array value sampled
+using csa_default_t = sdsl::csa_wt<sdsl::wt_huff<>, 32, 64>;
+// Every 4th suffix array value sampled, locating is about 8 times faster than
+// with the default profile at the cost of about 16 bits per character
+using csa_fast_t = sdsl::csa_wt<sdsl::wt_huff<>, 4, 64>;
+// Compressed wavelet tree bit vectors and every 128th text position sampled.
+// The inverse suffix array is derived from the same samples.
+using csa_small_t = sdsl::csa_wt<
+  sdsl::wt_huff<sdsl::rrr_vector<63>>, 128, 128,
+  sdsl::text_order_sa_sampling<>, sdsl::text_order_isa_sampling_support<>
+>;
+
+Profile parse_profile(const std::string& name) {
+  for (std::uint32_t i = 0; i < sizeof(profile_names) / sizeof(*profile_names); i++)
+    if (name == profile_names[i])
+      return static_cast<Profile>(i);
+  stop("Unknown index profile " + name);
+}
+
+template<class T>
+struct type_tag {
+  using type = T;
+};
+
+// Calls f with a type_tag of the csa_wt specialization of the profile
+template<class F>
+auto with_profile(Profile profile, F f) -> decltype(f(type_tag<csa_default_t>())) {
+  switch (profile) {
+  case Profile::standard:
+    return f(type_tag<csa_default_t>());
+  case Profile::fast:
+    return f(type_tag<csa_fast_t>());
+  case Profile::small:
+    return f(type_tag<csa_small_t>());
+  // Not a CsaSegment, see create_segment()
+  case Profile::repetitive:
+    break;
+  }
+  stop("Index file was created with an unknown profile, please re-create the index");
+}
+
+// Selects the sdsl suffix array construction algorithm of the calling thread
+// for the lifetime of the object, restoring the previous one also if
+// construction fails
+class SaAlgorithm {
+public:
+  SaAlgorithm(sdsl::byte_sa_algo_type algorithm, int n_threads = 1) :
+    previous(sdsl::construct_config())
+  {
+    sdsl::construct_config().byte_algo_sa = algorithm;
+    sdsl::construct_config().n_threads = std::max(n_threads, 1);
+  };
+  ~SaAlgorithm() {
+    sdsl::construct_config() = previous;
+  };
+private:
+  const sdsl::construct_config_data previous;
+};
+
+// Deletes the temporary files of an index construction, also if construction
+// fails
+class DiskConstruction {
+public:
+  DiskConstruction(const std::string& dir) : config(true, dir) {};
+  ~DiskConstruction() {
+    sdsl::util::delete_all_files(config.file_map);
+  };
+  sdsl::cache_config config;
+};
+
+// Corpus strings [begin, end) concatenated with separators, the input of one
+// segment. Prepared on the main thread, as the worker threads building
+// segments must not touch R objects.
+class SegmentText {
+public:
+  SegmentText() {};
+  SegmentText(
+    const CharacterVector& strings, R_xlen_t begin, R_xlen_t end,
+    const std::string& temp_dir
+  );
+  // Start of every string within the text
+  std::vector<DocumentBoundaries::size_type> starts;
+  DocumentBoundaries::size_type size = 0;
+  // The concatenated text, unless constructing on disk
+  std::string text;
+  // Otherwise the text file in the cache of the disk construction
+  std::unique_ptr<DiskConstruction> disk;
+  // Removes the text of deleted strings, keeping their separators so that
+  // corpus string indices do not change
+  void clear_documents(const Tombstones& tombstones);
+private:
+  void write_disk_text(
+    const CharacterVector& strings, R_xlen_t begin, R_xlen_t end,
+    const std::string& dir
+  );
+};
+
+SegmentText::SegmentText(
+  const CharacterVector& strings, R_xlen_t begin, R_xlen_t end,
+  const std::string& temp_dir
+) {
+  starts.reserve(end - begin);
+  for (R_xlen_t i = begin; i < end; i++) {
+    const auto x = strings[i];
+    if (std::find(x.begin(), x.end(), document_separator) != x.end())
+      stop("Corpus strings must not contain the ASCII control character 0x01");
+    starts.push_back(size);
+    size += x.size() + 1;
+  }
+  if (!temp_dir.empty()) {
+    write_disk_text(strings, begin, end, temp_dir);
+    return;
+  }
+  text.reserve(size);
+  for (R_xlen_t i = begin; i < end; i++) {
+    const auto x = strings[i];
+    text.append(x.begin(), x.end());
+    text.push_back(document_separator);
+  }
+}
+
+// Writes the text file that sdsl::construct expects in the cache of disk,
+// write(out) writing the size characters of the text. Returns false if
+// writing failed.
+template<class F>
+bool write_cache_text(DiskConstruction& disk, std::uint64_t size, F write) {
+  const auto path = sdsl::cache_file_name(sdsl::conf::KEY_TEXT, disk.config);
+  {
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+      return false;
+    // Same layout as a serialized sdsl::int_vector<8>, including the sentinel
+    sdsl::int_vector<8>::write_header((size + 1) * 8, 8, out);
+    write(out);
+    out.put(0);
+    // Data is stored in whole 64 bit words
+    for (auto i = size + 1; i % 8 != 0; i++)
+      out.put(0);
+    if (!out)
+      return false;
+  }
+  sdsl::register_cache_file(sdsl::conf::KEY_TEXT, disk.config);
+  return true;
+}
+
+// For corpora too large to be concatenated in memory, the strings are
+// streamed to the text file of the disk construction
+void SegmentText::write_disk_text(
+  const CharacterVector& strings, R_xlen_t begin, R_xlen_t end,
+  const std::string& dir
+) {
+  disk.reset(new DiskConstruction(dir));
+  const bool written = write_cache_text(*disk, size, [&](std::ofstream& out) {
+    std::ostreambuf_iterator<char> out_it(out);
+    for (R_xlen_t i = begin; i < end; i++) {
+      const auto x = strings[i];
+      out_it = std::copy(x.begin(), x.end(), out_it);
+      out.put(document_separator);
+    }
+  });
+  if (!written)
+    stop("Could not write temporary file in " + dir);
+}
+
+void SegmentText::clear_documents(const Tombstones& tombstones) {
+  if (tombstones.n_deleted() == 0)
+    return;
+  DocumentBoundaries::size_type out = 0;
+  for (size_t doc = 0; doc < starts.size(); doc++) {
+    const auto end = doc + 1 < starts.size() ? starts[doc + 1] : size;
+    const auto begin = tombstones.is_deleted(doc) ? end - 1 : starts[doc];
+    std::copy(text.begin() + begin, text.begin() + end, text.begin() + out);
+    starts[doc] = out;
+    out += end - begin;
+  }
+  size = out;
+  text.resize(size);
+}
+
+// Optional index structures of a segment
+struct SegmentOptions {
+  // Document listing support for fm_index_documents()
+  bool document_listing = false;
+  // Index of the reversed text for approximate search
+  bool bidirectional = false;
+  // Length of the q-grams in the table of their suffix array ranges, 0 for
+  // no table
+  std::uint64_t qgram_length = 0;
+};
+
+// Part of corpus strings a pattern has to match
+enum class Anchor { none, start, end, full };
+
+const char* anchor_names[] = {"none", "start", "end", "full"};
+
+// Takes the first element, like match.arg() with its default choices
+Anchor parse_anchor(const CharacterVector& anchor) {
+  if (anchor.size() == 0)
+    stop("Unknown anchor");
+  const std::string name(anchor[0]);
+  for (std::uint32_t i = 0; i < sizeof(anchor_names) / sizeof(*anchor_names); i++)
+    if (name == anchor_names[i])
+      return static_cast<Anchor>(i);
+  stop("Unknown anchor " + name);
+}
+
+// Suffix array rows of the hits of a pattern in a segment. Hits anchored at
+// the start of corpus strings are found by a backward search step beyond the
+// pattern, to the separator ending the preceding string. Their rows are
+// shifted, pointing at that separator, and a hit at the start of the first
+// string, which no separator precedes, is flagged instead.
+struct SegmentHits {
+  std::uint64_t range_begin = 0;
+  std::uint64_t n = 0;
+  // Suffix array value of the last row, only set by segments that need it
+  // to locate the range
+  std::uint64_t toehold = 0;
+  bool shifted = false;
+  bool first_document = false;
+  std::uint64_t size() const { return n + first_document; };
+};
+
+// Number of characters of context decoded on either side of every hit
+struct HitContext {
+  bool enabled = false;
+  std::uint64_t left = 0;
+  std::uint64_t right = 0;
+};
+
+// Context is counted in bytes. UTF-8 characters cut at its edges are
+// dropped, so that snippets remain valid strings.
+void trim_utf8_left(std::string& text) {
+  size_t i = 0;
+  while (i < text.size() && (static_cast<unsigned char>(text[i]) & 0xC0) == 0x80)
+    i++;
+  text.erase(0, i);
+}
+
+void trim_utf8_right(std::string& text) {
+  size_t i = text.size();
+  while (i > 0 && (static_cast<unsigned char>(text[i - 1]) & 0xC0) == 0x80)
+    i--;
+  if (i == 0)
+    return;
+  const auto c = static_cast<unsigned char>(text[i - 1]);
+  const size_t length = c < 0x80 ? 1 : (c & 0xE0) == 0xC0 ? 2 : (c & 0xF0) == 0xE0 ? 3 : 4;
+  if (text.size() - (i - 1) < length)
+    text.resize(i - 1);
+}
+
+// Index over consecutive corpus strings. An FMIndex consists of one or more
+// segments, which are built and searched from worker threads and therefore
+// never touch R objects. Corpus string indices are local to the segment.
+class Segment {
+public:
+  using size_type = std::uint64_t;
+  virtual ~Segment() {};
+  // Builds the index of the text, from scratch
+  virtual void build(const SegmentText& text, const SegmentOptions& options) = 0;
+  // Appends the indexed text to text, for rebuilding
+  virtual void extract(SegmentText& text) const = 0;
+  virtual SegmentOptions options() const = 0;
+  // Finds the suffix array rows of every pattern with the given anchor.
+  // Patterns must be sorted by their reversed text, so that patterns sharing
+  // a suffix are adjacent and the suffix is searched only once.
+  virtual void find_sorted(
+    const std::vector<const std::string*>& patterns, Anchor anchor,
+    std::vector<SegmentHits>& hits
+  ) const = 0;
+  // Finds the suffix array ranges of all substrings within max_distance of
+  // the pattern
+  virtual void find_approximate(
+    const std::string& pattern, size_type max_distance, Metric metric,
+    std::vector<ApproximateRange>& ranges
+  ) const = 0;
+  // Finds the suffix array ranges of all substrings matching a parsed
+  // pattern, with distance 0
+  virtual void find_pattern(
+    const std::vector<PatternElement>& pattern, std::vector<ApproximateRange>& ranges
+  ) const = 0;
+  // Whether single rows can be located. Otherwise only whole ranges can be,
+  // starting from the suffix array value of their last row (the toehold).
+  virtual bool locates_rows() const = 0;
+  // Corpus string and position within that string of the n suffix array
+  // rows from range_begin
+  virtual void locate_range(
+    size_type range_begin, size_type n, size_type toehold,
+    std::vector< std::pair<size_type, size_type> >& hits
+  ) const = 0;
+  // Locates a single row, also decoding up to left characters preceding it
+  // within its corpus string into text. Only if locates_rows().
+  virtual void locate_context(
+    size_type row, size_type left, size_type& document, size_type& position,
+    std::string& text
+  ) const = 0;
+  // Corpus strings occurring in a suffix array range in ascending order, with
+  // the number of hits in each if counts is set
+  virtual void documents(
+    size_type range_begin, size_type n, size_type toehold, bool counts,
+    std::vector< std::pair<size_type, size_type> >& documents
+  ) const = 0;
+  // Number of corpus strings
+  size_type n_documents() const { return boundaries.size(); };
+  // Length of corpus string doc in the indexed text
+  size_type document_size(size_type doc) const {
+    return boundaries.end(doc) - boundaries.start(doc) - 1;
+  };
+  // Decodes length characters of corpus string doc from position begin
+  virtual void substring(
+    size_type doc, size_type begin, size_type length, std::string& text
+  ) const = 0;
+  // Length of the indexed text including separators and the sentinel
+  virtual size_type size() const = 0;
+  virtual void save(cereal::AlignedOutputArchive& archive) const = 0;
+  virtual void load(cereal::AlignedInputArchive& archive) = 0;
+  // Set when loaded with mmap, the index structures then point into the
+  // mapped file. Members of the base class are destroyed last, the mapping
+  // after boundaries.
+  std::shared_ptr<MappedFile> mapping;
+protected:
+  DocumentBoundaries boundaries;
+  // Locates every hit in the suffix array range and counts hits per string
+  void tally_documents(
+    size_type range_begin, size_type n, size_type toehold,
+    std::vector< std::pair<size_type, size_type> >& documents
+  ) const;
+};
+
+void Segment::tally_documents(
+  size_type range_begin, size_type n, size_type toehold,
+  std::vector< std::pair<size_type, size_type> >& documents
+) const {
+  std::vector< std::pair<size_type, size_type> > hits;
+  locate_range(range_begin, n, toehold, hits);
+  std::sort(hits.begin(), hits.end());
+  for (const auto& hit: hits) {
+    if (documents.empty() || documents.back().first != hit.first)
+      documents.emplace_back(hit.first, 0);
+    documents.back().second++;
+  }
+}
+
+// Walks the text of index backwards from the sentinel using LF, passing its
+// characters to f, the last one first
+template<class csa_t, class F>
+void walk_text_backwards(const csa_t& index, F f) {
+  Segment::size_type row = 0;
+  for (auto n = index.size() - 1; n-- > 0;) {
+    f(index.bwt[row]);
+    row = index.lf[row];
+  }
+}
+
+// Appends the text of index, whose corpus strings start at boundaries, to
+// text
+template<class csa_t>
+void extract_text(const csa_t& index, const DocumentBoundaries& boundaries, SegmentText& text) {
+  const auto offset = text.size;
+  for (Segment::size_type doc = 0; doc < boundaries.size(); doc++)
+    text.starts.push_back(offset + boundaries.start(doc));
+  text.size += boundaries.text_size();
+  text.text.resize(text.size);
+  auto pos = text.size;
+  walk_text_backwards(index, [&](char c) { text.text[--pos] = c; });
+}
+
+template<class csa_t>
+class CsaSegment : public Segment {
+public:
+  void build(const SegmentText& text, const SegmentOptions& options) override;
+  void extract(SegmentText& text) const override { extract_text(index, boundaries, text); };
+  SegmentOptions options() const override {
+    SegmentOptions options;
+    options.document_listing = document_rmq.size() > 0;
+    options.bidirectional = reverse_index.size() > 0;
+    options.qgram_length = qgrams.requested_q();
+    return options;
+  };
+  void find_sorted(
+    const std::vector<const std::string*>& patterns, Anchor anchor,
+    std::vector<SegmentHits>& hits
+  ) const override;
+  void find_approximate(
+    const std::string& pattern, size_type max_distance, Metric metric,
+    std::vector<ApproximateRange>& ranges
+  ) const override {
+    if (reverse_index.size() > 0 && SchemeSearch<csa_t>::applicable(pattern, max_distance)) {
+      SchemeSearch<csa_t>(index, reverse_index, pattern, max_distance, document_separator)
+        .run(metric, ranges);
+    } else {
+      ApproximateSearch<csa_t>(index, pattern, max_distance, document_separator)
+        .run(metric, ranges);
+    }
+  };
+  void find_pattern(
+    const std::vector<PatternElement>& pattern, std::vector<ApproximateRange>& ranges
+  ) const override {
+    PatternSearch<csa_t>(index, pattern).run(ranges);
+  };
+  bool locates_rows() const override { return true; };
+  void locate_range(
+    size_type range_begin, size_type n, size_type toehold,
+    std::vector< std::pair<size_type, size_type> >& hits
+  ) const override;
+  void locate_context(
+    size_type row, size_type left, size_type& document, size_type& position,
+    std::string& text
+  ) const override;
+  void documents(
+    size_type range_begin, size_type n, size_type toehold, bool counts,
+    std::vector< std::pair<size_type, size_type> >& documents
+  ) const override;
+  // Walks backwards from the last character, starting from one inverse
+  // suffix array lookup
+  void substring(
+    size_type doc, size_type begin, size_type length, std::string& text
+  ) const override {
+    text.resize(length);
+    if (length == 0)
+      return;
+    const auto start = boundaries.start(doc) + begin;
+    sdsl::extract(index, start, start + length - 1, text.begin());
+  };
+  size_type size() const override { return index.size(); };
+  void save(cereal::AlignedOutputArchive& archive) const override {
+    archive(index, boundaries, document_rmq, reverse_index, qgrams);
+  };
+  void load(cereal::AlignedInputArchive& archive) override {
+    archive(index, boundaries, document_rmq, reverse_index, qgrams);
+  };
+private:
+  csa_t index;
+  // Index of the reversed text, empty unless built bidirectional
+  csa_t reverse_index;
+  // Range minimum queries over the suffix array positions, where each
+  // position stores the closest preceding position pointing into the same
+  // corpus string. Empty unless built with document listing support.
+  sdsl::rmq_succinct_sct<> document_rmq;
+  // Suffix array ranges of short strings, empty unless built with a q-gram
+  // length
+  QGramTable qgrams;
+  void build_document_listing();
+  void build_reverse_index(const SegmentText& text);
+  void list_documents(
+    size_type range_begin, size_type n,
+    std::vector< std::pair<size_type, size_type> >& documents
+  ) const;
+};
+
+// The sdsl construction algorithm is selected by the caller with SaAlgorithm.
+// On disk, the suffix array is built semi-externally, holding only the text
+// in memory, and later construction steps stream it from disk.
+template<class csa_t>
+void CsaSegment<csa_t>::build(const SegmentText& text, const SegmentOptions& options) {
+  boundaries = DocumentBoundaries(text.starts, text.size);
+  if (text.disk) {
+    auto& config = text.disk->config;
+    sdsl::construct(index, sdsl::cache_file_name(sdsl::conf::KEY_TEXT, config), config, 1);
+  } else {
+    sdsl::construct_im(index, text.text, 1);
+  }
+  if (options.document_listing)
+    build_document_listing();
+  if (options.bidirectional)
+    build_reverse_index(text);
+  if (options.qgram_length > 0)
+    qgrams = QGramTable(index, options.qgram_length);
+}
+
+// The reversed text is read from the index, walking the text backwards
+// yields it in order. When constructing on disk, it is streamed to a text
+// file in the same directory as the text instead of held in memory.
+template<class csa_t>
+void CsaSegment<csa_t>::build_reverse_index(const SegmentText& text) {
+  if (!text.disk) {
+    std::string reversed;
+    reversed.reserve(index.size() - 1);
+    walk_text_backwards(index, [&](char c) { reversed.push_back(c); });
+    sdsl::construct_im(reverse_index, reversed, 1);
+    return;
+  }
+  DiskConstruction disk(text.disk->config.dir);
+  const bool written = write_cache_text(disk, index.size() - 1, [&](std::ofstream& out) {
+    std::ostreambuf_iterator<char> out_it(out);
+    walk_text_backwards(index, [&](char c) { *out_it++ = c; });
+  });
+  // Runs on a worker thread, which must not raise R errors
+  if (!written)
+    throw std::runtime_error("Could not write temporary file in " + disk.config.dir);
+  sdsl::construct(reverse_index, sdsl::cache_file_name(sdsl::conf::KEY_TEXT, disk.config), disk.config, 1);
+}
+
+// Anchors cost at most one more backward search step each: matches at the
+// end of strings are followed by the separator, and matches at the start of
+// strings are preceded by it, or by the sentinel at the end of the text for
+// the first string.
+//
+// The patterns are searched breadth-first in the trie of their reversed
+// texts, one character per round, so every shared suffix is searched only
+// once. The backward search steps of a round are independent of each other
+// and interleaved by rank_batch() to overlap their cache misses. With a
+// q-gram table, the search starts from the rows of the last characters of
+// the patterns, up to q in total with the separator for end anchors.
+template<class csa_t>
+void CsaSegment<csa_t>::find_sorted(
+  const std::vector<const std::string*>& patterns, Anchor anchor,
+  std::vector<SegmentHits>& hits
+) const {
+  using symbol_type = typename csa_t::wavelet_tree_type::value_type;
+  // Patterns [first, last) sharing their last depth characters, and their
+  // rows
+  struct Node {
+    size_t first, last;
+    size_type begin, n;
+  };
+  std::vector<symbol_type> symbols, rank_symbols;
+  std::vector<size_type> positions, ranks;
+  // Prepends symbols[k] to the rows of nodes[k]
+  auto backward_steps = [&](std::vector<Node>& nodes) {
+    rank_symbols.resize(2 * nodes.size());
+    positions.resize(2 * nodes.size());
+    ranks.resize(2 * nodes.size());
+    for (size_t k = 0; k < nodes.size(); k++) {
+      rank_symbols[2 * k] = rank_symbols[2 * k + 1] = symbols[k];
+      positions[2 * k] = nodes[k].begin;
+      positions[2 * k + 1] = nodes[k].begin + nodes[k].n;
+    }
+    index.wavelet_tree.rank_batch(positions.data(), rank_symbols.data(), ranks.data(), positions.size());
+    for (size_t k = 0; k < nodes.size(); k++) {
+      nodes[k].begin = index.C[index.char2comp[symbols[k]]] + ranks[2 * k];
+      nodes[k].n = ranks[2 * k + 1] - ranks[2 * k];
+    }
+  };
+  // Character depth positions from the end of pattern i
+  auto symbol = [&](size_t i, size_t depth) -> symbol_type {
+    const auto& pattern = *patterns[i];
+    return pattern[pattern.size() - 1 - depth];
+  };
+  hits.assign(patterns.size(), SegmentHits());
+  const bool end_anchored = anchor == Anchor::end || anchor == Anchor::full;
+  const size_t max_lookup = qgrams.q() > end_anchored ? qgrams.q() - end_anchored : 0;
+  std::vector<Node> level, next, found;
+  size_t depth = max_lookup;
+  if (max_lookup == 0) {
+    level.push_back({0, patterns.size(), 0, index.size()});
+    if (end_anchored) {
+      symbols.assign(1, document_separator);
+      backward_steps(level);
+    }
+  } else {
+    // Patterns shorter than max_lookup are found by the lookup, longer ones
+    // continue from the rows of their last max_lookup characters
+    std::string qgram;
+    for (size_t i = 0, j; i < patterns.size(); i = j) {
+      const auto& pattern = *patterns[i];
+      const bool shorter = pattern.size() < max_lookup;
+      const size_t length = shorter ? pattern.size() : max_lookup;
+      for (j = i + 1; j < patterns.size(); j++) {
+        const auto& other = *patterns[j];
+        if (shorter ? other.size() != length : other.size() < length)
+          break;
+        if (!std::equal(pattern.end() - length, pattern.end(), other.end() - length))
+          break;
+      }
+      qgram.assign(pattern.end() - length, pattern.end());
+      if (end_anchored)
+        qgram.push_back(document_separator);
+      Node node{i, j, 0, 0};
+      size_type node_end;
+      node.n = qgrams.find(index, qgram, node.begin, node_end);
+      (shorter ? found : level).push_back(node);
+    }
+  }
+  while (!level.empty()) {
+    next.clear();
+    symbols.clear();
+    for (const auto& node: level) {
+      // Patterns ending at this depth sort first
+      auto i = node.first;
+      while (i < node.last && patterns[i]->size() == depth)
+        i++;
+      if (i > node.first)
+        found.push_back({node.first, i, node.begin, node.n});
+      if (node.n == 0)
+        continue;
+      for (size_t j; i < node.last; i = j) {
+        const auto c = symbol(i, depth);
+        for (j = i + 1; j < node.last && symbol(j, depth) == c; j++) {}
+        next.push_back({i, j, node.begin, node.n});
+        symbols.push_back(c);
+      }
+    }
+    backward_steps(next);
+    level.swap(next);
+    depth++;
+  }
+  for (const auto& node: found) {
+    for (auto i = node.first; i < node.last; i++) {
+      hits[i].range_begin = node.begin;
+      hits[i].n = node.n;
+    }
+  }
+  if (anchor == Anchor::none || anchor == Anchor::end)
+    return;
+  // The sentinel precedes a match in the first string, the separator all
+  // others
+  found.erase(std::remove_if(found.begin(), found.end(), [](const Node& node) {
+    return node.n == 0;
+  }), found.end());
+  auto preceding = found;
+  symbols.assign(found.size(), 0);
+  backward_steps(preceding);
+  symbols.assign(found.size(), document_separator);
+  backward_steps(found);
+  for (size_t k = 0; k < found.size(); k++) {
+    for (auto i = found[k].first; i < found[k].last; i++) {
+      hits[i].shifted = true;
+      hits[i].first_document = preceding[k].n > 0;
+      hits[i].range_begin = found[k].begin;
+      hits[i].n = found[k].n;
+    }
+  }
+}
+
+// Number of rows locate_range() walks towards their suffix array samples at
+// the same time
+const size_t locate_batch_width = 32;
+
+// Locating a row takes a chain of LF steps, each waiting for the cache misses
+// of the previous one. Rows are walked in lanes of locate_batch_width instead,
+// with their LF steps interleaved by inverse_select_batch(). A lane whose row
+// reaches a sample takes over the next row right away.
+template<class csa_t>
+void CsaSegment<csa_t>::locate_range(
+  size_type range_begin, size_type n, size_type,
+  std::vector< std::pair<size_type, size_type> >& hits
+) const {
+  using symbol_type = typename csa_t::wavelet_tree_type::value_type;
+  hits.resize(n);
+  size_type rows[locate_batch_width], steps[locate_batch_width], slots[locate_batch_width];
+  std::pair<size_type, symbol_type> lf[locate_batch_width];
+  size_type next = 0, m = 0;
+  while (next < n || m > 0) {
+    for (; m < locate_batch_width && next < n; m++, next++) {
+      rows[m] = range_begin + next;
+      steps[m] = 0;
+      slots[m] = next;
+    }
+    for (size_type k = 0; k < m;) {
+      if (!index.sa_sample.is_sampled(rows[k])) {
+        k++;
+        continue;
+      }
+      const auto location = (index.sa_sample[rows[k]] + steps[k]) % index.size();
+      const auto document = boundaries.document(location);
+      hits[slots[k]] = std::make_pair(document, location - boundaries.start(document));
+      m--;
+      rows[k] = rows[m];
+      steps[k] = steps[m];
+      slots[k] = slots[m];
+    }
+    index.wavelet_tree.inverse_select_batch(rows, lf, m);
+    for (size_type k = 0; k < m; k++) {
+      rows[k] = index.C[index.char2comp[lf[k].second]] + lf[k].first;
+      steps[k]++;
+    }
+  }
+}
+
+// Every LF step towards the next suffix array sample passes the character
+// preceding the current suffix, so the left context is read off the steps
+// locating the hit takes anyway. Steps continue past the sample only for
+// context longer than the distance to it.
+template<class csa_t>
+void CsaSegment<csa_t>::locate_context(
+  size_type row, size_type left, size_type& document, size_type& position,
+  std::string& text
+) const {
+  text.clear();
+  bool located = false, reading = left > 0;
+  size_type location = 0, steps = 0;
+  while (true) {
+    if (!located && index.sa_sample.is_sampled(row)) {
+      location = (index.sa_sample[row] + steps) % index.size();
+      located = true;
+    }
+    if (located && !reading)
+      break;
+    const auto x = index.wavelet_tree.inverse_select(row);
+    if (reading) {
+      if (x.second == 0 || x.second == static_cast<unsigned char>(document_separator))
+        reading = false;
+      else
+        text.push_back(x.second);
+      reading = reading && text.size() < left;
+    }
+    row = index.C[index.char2comp[x.second]] + x.first;
+    steps++;
+  }
+  std::reverse(text.begin(), text.end());
+  document = boundaries.document(location);
+  position = location - boundaries.start(document);
+}
+
+// Sadakane's document listing needs, for every suffix array position, the
+// closest preceding position in the same corpus string. The text is walked
+// backwards one string at a time using LF, collecting the suffix array
+// positions of each string, which sorted give the preceding positions.
+template<class csa_t>
+void CsaSegment<csa_t>::build_document_listing() {
+  const auto n = index.size();
+  // Shifted by one, 0 means no preceding position
+  sdsl::int_vector<> previous(n, 0, sdsl::bits::hi(n) + 1);
+  std::vector<size_type> rows;
+  // Row 0 is the suffix consisting only of the sentinel at text position n - 1
+  size_type row = 0, pos = n - 1;
+  for (auto doc = boundaries.size(); doc-- > 0;) {
+    rows.clear();
+    const auto start = boundaries.start(doc);
+    while (pos > start) {
+      row = index.lf[row];
+      pos--;
+      rows.push_back(row);
+    }
+    std::sort(rows.begin(), rows.end());
+    for (size_t i = 1; i < rows.size(); i++)
+      previous[rows[i]] = rows[i - 1] + 1;
+  }
+  document_rmq = sdsl::rmq_succinct_sct<>(&previous);
+}
+
+template<class csa_t>
+void CsaSegment<csa_t>::documents(
+  size_type range_begin, size_type n, size_type, bool counts,
+  std::vector< std::pair<size_type, size_type> >& documents
+) const {
+  if (n == 0)
+    return;
+  if (!counts && document_rmq.size() > 0)
+    list_documents(range_begin, n, documents);
+  else
+    tally_documents(range_begin, n, 0, documents);
+}
+
+// Reports every corpus string occurring in the suffix array range exactly
+// once, in time proportional to the number of distinct strings. The leftmost
+// position whose preceding position lies outside the range is the first
+// occurrence of its string. Recursing left before right guarantees that a
+// string already reported marks a subrange without new strings.
+template<class csa_t>
+void CsaSegment<csa_t>::list_documents(
+  size_type range_begin, size_type n,
+  std::vector< std::pair<size_type, size_type> >& documents
+) const {
+  std::unordered_set<size_type> seen;
+  std::vector< std::pair<size_type, size_type> > stack;
+  stack.emplace_back(range_begin, range_begin + n - 1);
+  while (!stack.empty()) {
+    const auto range = stack.back();
+    stack.pop_back();
+    const auto i = document_rmq(range.first, range.second);
+    const auto doc = boundaries.document(index[i]);
+    if (!seen.insert(doc).second)
+      continue;
+    documents.emplace_back(doc, 0);
+    if (i < range.second)
+      stack.emplace_back(i + 1, range.second);
+    if (i > range.first)
+      stack.emplace_back(range.first, i - 1);
+  }
+  std::sort(documents.begin(), documents.end());
+}
+
+// BWT stored as runs of equal characters, without suffix array samples. The
+// r-index locates a range from the suffix array value of its last row
+// instead, kept up to date during backward search, and phi.
+using csa_repetitive_t = sdsl::csa_wt<sdsl::wt_rlmn<>, 1u << 31, 1u << 31>;
+
+// Extracting a substring takes up to this many LF steps beyond its length,
+// the samples cost about 1 / 8 bit per character for texts of 2^32 characters
+const std::uint64_t text_sample_rate = 256;
 
+// Segment for highly repetitive corpora, whose size grows with the number of
+// runs in the BWT rather than with the length of the text. Every row is
+// located by one phi step from its successor, but only whole ranges can be.
+// Approximate search, document listing and q-gram tables are not supported.
+class RIndexSegment : public Segment {
+public:
+  void build(const SegmentText& text, const SegmentOptions& options) override;
+  void extract(SegmentText& text) const override { extract_text(index, boundaries, text); };
+  SegmentOptions options() const override { return SegmentOptions(); };
+  void find_sorted(
+    const std::vector<const std::string*>& patterns, Anchor anchor,
+    std::vector<SegmentHits>& hits
+  ) const override;
+  void find_approximate(
+    const std::string&, size_type, Metric, std::vector<ApproximateRange>&
+  ) const override {
+    throw std::logic_error("Approximate search is not supported by the repetitive profile");
+  };
+  void find_pattern(
+    const std::vector<PatternElement>&, std::vector<ApproximateRange>&
+  ) const override {
+    throw std::logic_error("Pattern search is not supported by the repetitive profile");
+  };
+  bool locates_rows() const override { return false; };
+  void locate_range(
+    size_type range_begin, size_type n, size_type toehold,
+    std::vector< std::pair<size_type, size_type> >& hits
+  ) const override;
+  void locate_context(
+    size_type, size_type, size_type&, size_type&, std::string&
+  ) const override {
+    throw std::logic_error("Rows cannot be located one at a time by the repetitive profile");
+  };
+  // Always locates the whole range
+  void documents(
+    size_type range_begin, size_type n, size_type toehold, bool,
+    std::vector< std::pair<size_type, size_type> >& documents
+  ) const override {
+    tally_documents(range_begin, n, toehold, documents);
+  };
+  void substring(
+    size_type doc, size_type begin, size_type length, std::string& text
+  ) const override;
+  size_type size() const override { return index.size(); };
+  void save(cereal::AlignedOutputArchive& archive) const override {
+    archive(index, boundaries, run_end_values, last_value, phi, sampled_rows);
+  };
+  void load(cereal::AlignedInputArchive& archive) override {
+    archive(index, boundaries, run_end_values, last_value, phi, sampled_rows);
+  };
+private:
+  // Rows of a backward search and the suffix array value of the last one
+  struct Range {
+    size_type begin, n, toehold;
+  };
+  Range backward_step(const Range& range, unsigned char c) const;
+  csa_repetitive_t index;
+  // Suffix array value of the last row of every run of the BWT
+  sdsl::int_vector<> run_end_values;
+  // Suffix array value of the last row
+  size_type last_value = 0;
+  PhiSamples phi;
+  // Row of every text_sample_rate-th text position, where extracting
+  // substrings starts
+  sdsl::int_vector<> sampled_rows;
+};
+
+// The samples are collected by walking the text backwards from the sentinel
+// using LF, which visits every row once together with its suffix array value
+void RIndexSegment::build(const SegmentText& text, const SegmentOptions&) {
+  boundaries = DocumentBoundaries(text.starts, text.size);
+  if (text.disk) {
+    auto& config = text.disk->config;
+    sdsl::construct(index, sdsl::cache_file_name(sdsl::conf::KEY_TEXT, config), config, 1);
+  } else {
+    sdsl::construct_im(index, text.text, 1);
+  }
+  const auto n = index.size();
+  const auto& bwt = index.wavelet_tree;
+  const auto width = sdsl::bits::hi(n) + 1;
+  // Plain copy of the first rows of runs, which is much faster to query
+  // than the compressed one of the wavelet tree
+  sdsl::bit_vector heads(n + 1, 0);
+  for (size_type run = 0; run < bwt.runs(); run++)
+    heads[bwt.run_begin(run)] = 1;
+  heads[n] = 1;
+  sdsl::rank_support_v<> heads_rank(&heads);
+  sdsl::int_vector<> run_start_values(bwt.runs(), 0, width);
+  run_end_values = sdsl::int_vector<>(bwt.runs(), 0, width);
+  sampled_rows = sdsl::int_vector<>((n - 1) / text_sample_rate + 1, 0, width);
+  size_type row = 0;
+  for (auto pos = n; pos-- > 0;) {
+    const auto run = heads_rank(row + 1) - 1;
+    if (heads[row])
+      run_start_values[run] = pos;
+    if (heads[row + 1])
+      run_end_values[run] = pos;
+    if (pos % text_sample_rate == 0)
+      sampled_rows[pos / text_sample_rate] = row;
+    row = index.lf[row];
+  }
+  last_value = run_end_values[bwt.runs() - 1];
+  // The row preceding the first row of a run is the last row of the run
+  // before
+  std::vector< std::pair<size_type, size_type> > samples;
+  samples.reserve(bwt.runs() - 1);
+  for (size_type run = 1; run < bwt.runs(); run++)
+    samples.emplace_back(run_start_values[run], run_end_values[run - 1]);
+  phi = PhiSamples(samples, n);
+}
+
+// Toehold lemma: if the last row of the range is preceded by c, the last row
+// of the new range follows from it by LF. Otherwise that is the last row
+// preceded by c within the range, which ends a run.
+RIndexSegment::Range RIndexSegment::backward_step(const Range& range, unsigned char c) const {
+  const auto& bwt = index.wavelet_tree;
+  const auto rank_begin = bwt.rank(range.begin, c);
+  const auto rank_end = bwt.rank(range.begin + range.n, c);
+  Range next{index.C[index.char2comp[c]] + rank_begin, rank_end - rank_begin, 0};
+  if (next.n == 0)
+    return next;
+  const auto last = range.begin + range.n - 1;
+  const auto value = bwt[last] == c ? range.toehold :
+    run_end_values[bwt.run(bwt.select(rank_end, c))];
+  next.toehold = (value + index.size() - 1) % index.size();
+  return next;
+}
+
+// Patterns are searched depth-first in the trie of their reversed texts, each
+// pattern continuing from the ranges of the suffix it shares with the
+// preceding one. Anchors take the same steps as in CsaSegment::find_sorted().
+void RIndexSegment::find_sorted(
+  const std::vector<const std::string*>& patterns, Anchor anchor,
+  std::vector<SegmentHits>& hits
+) const {
+  hits.assign(patterns.size(), SegmentHits());
+  // Ranges of the last depth characters of the previous pattern at depth
+  std::vector<Range> stack(1, Range{0, index.size(), last_value});
+  if (anchor == Anchor::end || anchor == Anchor::full)
+    stack[0] = backward_step(stack[0], document_separator);
+  const std::string* previous = nullptr;
+  for (size_t i = 0; i < patterns.size(); i++) {
+    const auto& pattern = *patterns[i];
+    size_t depth = 0;
+    if (previous) {
+      const auto limit = std::min(stack.size() - 1, std::min(pattern.size(), previous->size()));
+      while (depth < limit && pattern[pattern.size() - 1 - depth] == (*previous)[previous->size() - 1 - depth])
+        depth++;
+    }
+    stack.resize(depth + 1);
+    while (depth < pattern.size() && stack.back().n > 0) {
+      stack.push_back(backward_step(stack.back(), pattern[pattern.size() - 1 - depth]));
+      depth++;
+    }
+    previous = &pattern;
+    // A pattern not found stops short of its length, which is fine as long
+    // as its range is empty
+    const auto& range = stack.back();
+    if (range.n == 0)
+      continue;
+    auto& x = hits[i];
+    x.range_begin = range.begin;
+    x.n = range.n;
+    x.toehold = range.toehold;
+    if (anchor == Anchor::none || anchor == Anchor::end)
+      continue;
+    const auto shifted = backward_step(range, document_separator);
+    x.shifted = true;
+    x.first_document = backward_step(range, 0).n > 0;
+    x.range_begin = shifted.begin;
+    x.n = shifted.n;
+    x.toehold = shifted.toehold;
+  }
+}
+
+// Walks the range backwards from its last row using phi
+void RIndexSegment::locate_range(
+  size_type, size_type n, size_type toehold,
+  std::vector< std::pair<size_type, size_type> >& hits
+) const {
+  hits.resize(n);
+  auto location = toehold;
+  for (auto i = n; i-- > 0;) {
+    const auto document = boundaries.document(location);
+    hits[i] = std::make_pair(document, location - boundaries.start(document));
+    if (i > 0)
+      location = phi(location);
+  }
+}
+
+// Walks backwards from the first sampled position after the substring, or
+// from the sentinel at the end of the text
+void RIndexSegment::substring(
+  size_type doc, size_type begin, size_type length, std::string& text
+) const {
+  text.resize(length);
+  if (length == 0)
+    return;
+  const auto start = boundaries.start(doc) + begin;
+  const auto sample = (start + length - 1) / text_sample_rate + 1;
+  auto pos = index.size() - 1;
+  size_type row = 0;
+  if (sample < sampled_rows.size()) {
+    pos = sample * text_sample_rate;
+    row = sampled_rows[sample];
+  }
+  for (; pos > start; pos--) {
+    const auto x = index.wavelet_tree.inverse_select(row);
+    if (pos <= start + length)
+      text[pos - 1 - start] = x.second;
+    row = index.C[index.char2comp[x.second]] + x.first;
+  }
+}
+
+// Creates an empty segment of the profile
+std::shared_ptr<Segment> create_segment(Profile profile) {
+  if (profile == Profile::repetitive)
+    return std::make_shared<RIndexSegment>();
+  return with_profile(profile, [](auto tag) -> std::shared_ptr<Segment> {
+    return std::make_shared<CsaSegment<typename decltype(tag)::type>>();
+  });
+}
+
+// Index over the whole corpus, split into segments over consecutive corpus
+// strings. Queries search all segments and map corpus string indices of
+// segments to indices in the corpus.
 class FMIndex {
 public:
-  FMIndex() {};
-  FMIndex(tree_t index, std::vector<int> boundaries) : index(index), boundaries(boundaries) {};
-  FMIndex(const CharacterVector& text);
-  DataFrame locate(const CharacterVector& patterns);
-  template<class Archive>
-  void serialize(Archive& archive) {
-    archive(index, boundaries);
-  };
-  void load_file(const String& path);
-  void save_file(const String& path);
-  tree_t index;
-  std::vector<int> boundaries;
+  using size_type = Segment::size_type;
+  using TombstoneList = std::vector< std::shared_ptr<const Tombstones> >;
+  FMIndex(
+    Profile profile, std::vector< std::shared_ptr<Segment> > segments,
+    size_t n_shards, TombstoneList tombstones = TombstoneList()
+  );
+  ~FMIndex();
+  // Builds an index with n_shards segments of about equal size. Shards are
+  // built concurrently, each using a share of the threads.
+  static FMIndex* create(
+    const CharacterVector& strings, Profile profile, const SegmentOptions& options,
+    const std::string& temp_dir, int n_threads, int n_shards
+  );
+  // Indexes strings as a new segment following all others. Once appended
+  // segments exceed merge_threshold times the size of the last shard, they
+  // are merged into it, in a background thread unless background is false.
+  void append(const CharacterVector& strings, double merge_threshold, bool background);
+  // Marks corpus strings (0-based) as deleted
+  void erase(const std::vector<size_type>& documents);
+  // Rebuilds every segment in which the text of deleted strings makes up more
+  // than max_deleted of the indexed text, leaving out that text
+  void compact(double max_deleted, int n_threads);
+  DataFrame locate(
+    const CharacterVector& patterns, Anchor anchor, const HitContext& context,
+    int n_threads
+  ) const;
+  DataFrame locate_approximate(
+    const CharacterVector& patterns, size_type max_distance, Metric metric,
+    int n_threads
+  ) const;
+  DataFrame locate_pattern(const CharacterVector& patterns, int n_threads) const;
+  RObject count(const CharacterVector& patterns, Anchor anchor, int n_threads) const;
+  // Substrings of corpus strings (0-based) between the 1-based positions
+  // start and end, negative positions counting from the end like in
+  // stringi::stri_sub(). Deleted strings and missing_document give NA.
+  CharacterVector extract(
+    const std::vector<size_type>& documents, const std::vector<std::int64_t>& starts,
+    const std::vector<std::int64_t>& ends, int n_threads
+  ) const;
+  static const size_type missing_document = std::numeric_limits<size_type>::max();
+  DataFrame documents(const CharacterVector& patterns, bool counts, int n_threads) const;
+  // Number of corpus strings
+  size_type n_documents() const { return snapshot()->first_document.back(); };
+  size_type n_deleted() const;
+  // Length of the indexed texts of all segments
+  size_type size() const;
+  size_type n_shards() const { return snapshot()->n_shards; };
+  static FMIndex* load_file(const String& path, bool mmap = false);
+  void save_file(const String& path) const;
+  const Profile profile;
+private:
+  // The shards followed by the segments of appended strings, which are not
+  // merged into the last shard yet
+  struct SegmentList {
+    SegmentList(
+      std::vector< std::shared_ptr<Segment> > segments, size_t n_shards,
+      TombstoneList tombstones
+    );
+    std::vector< std::shared_ptr<Segment> > segments;
+    size_t n_shards;
+    // Deleted strings of every segment. Like segments, tombstones are never
+    // modified once in a list, deleting strings replaces them.
+    TombstoneList tombstones;
+    // Index of the first corpus string of every segment, followed by the
+    // total number of corpus strings
+    std::vector<size_type> first_document;
+  };
+  // Appends and merges replace the segment list as a whole, so queries
+  // running meanwhile keep searching the segments they started with
+  std::shared_ptr<const SegmentList> segments;
+  mutable std::mutex segments_mutex;
+  std::shared_ptr<const SegmentList> snapshot() const;
+  // Segment containing corpus string doc
+  static size_t find_segment(const SegmentList& list, size_type doc);
+  std::thread merge_thread;
+  std::atomic<bool> merging{false};
+  // Failure of the last merge, set before merging is reset
+  std::exception_ptr merge_error;
+  // Waits for a background merge and raises its failure as an R error
+  void join_merge();
+  void merge(std::shared_ptr<const SegmentList> merged, std::shared_ptr<Segment> target);
+  template<class F>
+  DataFrame locate_ranges(
+    const SegmentList& list, size_t n_patterns, int n_threads, bool with_distance, F find
+  ) const;
+  // If duplicate_of is given, it is set to the index of the first of every
+  // group of equal patterns, for each pattern of the group
+  void search(
+    const SegmentList& list, const std::vector<std::string>& patterns, Anchor anchor,
+    int n_threads, std::vector<SegmentHits>& hits,
+    std::vector<size_t>* duplicate_of = nullptr
+  ) const;
 };
 
-FMIndex::FMIndex(const CharacterVector& text) {
-  boundaries.reserve(text.size());
-  int string_length = 0;
-  for (const auto& x: text) {
-    string_length += x.size();
-    boundaries.push_back(string_length);
-  }
-  std::string text_concat;
-  text_concat.reserve(string_length);
-  for (const auto& x: text) {
-    text_concat.append(x);
-  }
-  sdsl::construct_im(index, text_concat, 1);
-}
-
-DataFrame FMIndex::locate(const CharacterVector& patterns) {
-  std::vector< std::vector<int> > all_locations;
-  int n_total = 0;
-  for (const auto& pattern: patterns) {
-    const auto locations_ = sdsl::locate(index, pattern.begin(), pattern.end());
-    const auto n = locations_.size();
-    n_total += n;
-    std::vector<int> locations;
-    locations.reserve(n);
-    for (const auto& x: locations_) {
-      locations.push_back(x);
-    }
-    all_locations.push_back(locations);
-  }
-  IntegerVector pattern_indices(n_total);
-  IntegerVector library_indices(n_total);
-  IntegerVector positions(n_total);
-  int i_total = 0;
-  for (int pattern_idx = 0; pattern_idx < patterns.size(); pattern_idx++) {
-    const auto locations = all_locations[pattern_idx];
-    for (const auto& location: locations) {
-      const auto library_index = std::distance(
-        boundaries.begin(),
-        std::upper_bound(boundaries.begin(), boundaries.end(), location)
+const FMIndex::size_type FMIndex::missing_document;
+
+// Segments missing tombstones at the end of the list, new ones, get empty
+// tombstones
+FMIndex::SegmentList::SegmentList(
+  std::vector< std::shared_ptr<Segment> > segments_, size_t n_shards,
+  TombstoneList tombstones_
+) : segments(std::move(segments_)), n_shards(n_shards), tombstones(std::move(tombstones_)) {
+  first_document.push_back(0);
+  for (const auto& segment: segments)
+    first_document.push_back(first_document.back() + segment->n_documents());
+  for (size_t i = tombstones.size(); i < segments.size(); i++)
+    tombstones.push_back(std::make_shared<const Tombstones>(segments[i]->n_documents()));
+}
+
+FMIndex::FMIndex(
+  Profile profile, std::vector< std::shared_ptr<Segment> > segments_,
+  size_t n_shards, TombstoneList tombstones
+) :
+  profile(profile),
+  segments(std::make_shared<const SegmentList>(
+    std::move(segments_), n_shards, std::move(tombstones)
+  ))
+{}
+
+// A merge still running has to finish, it uses the index
+FMIndex::~FMIndex() {
+  if (merge_thread.joinable())
+    merge_thread.join();
+}
+
+void FMIndex::join_merge() {
+  if (merge_thread.joinable())
+    merge_thread.join();
+  if (!merge_error)
+    return;
+  const auto error = merge_error;
+  merge_error = nullptr;
+  try {
+    std::rethrow_exception(error);
+  } catch (const std::exception& e) {
+    stop(std::string("Merging appended strings failed: ") + e.what());
+  } catch (...) {
+    stop("Merging appended strings failed");
+  }
+}
+
+std::shared_ptr<const FMIndex::SegmentList> FMIndex::snapshot() const {
+  std::lock_guard<std::mutex> lock(segments_mutex);
+  return segments;
+}
+
+size_t FMIndex::find_segment(const SegmentList& list, size_type doc) {
+  const auto& first_document = list.first_document;
+  return std::upper_bound(first_document.begin(), first_document.end(), doc) -
+    first_document.begin() - 1;
+}
+
+FMIndex::size_type FMIndex::n_deleted() const {
+  size_type n_deleted = 0;
+  for (const auto& tombstones: snapshot()->tombstones)
+    n_deleted += tombstones->n_deleted();
+  return n_deleted;
+}
+
+FMIndex::size_type FMIndex::size() const {
+  size_type size = 0;
+  for (const auto& segment: snapshot()->segments)
+    size += segment->size();
+  return size;
+}
+
+FMIndex* FMIndex::create(
+  const CharacterVector& strings, Profile profile, const SegmentOptions& options,
+  const std::string& temp_dir, int n_threads, int n_shards
+) {
+  const R_xlen_t n_strings = strings.size();
+  n_threads = std::max(n_threads, 1);
+  n_shards = std::max<R_xlen_t>(std::min<R_xlen_t>(n_shards, n_strings), 1);
+  // Shards begin at the first string beyond their share of the text
+  size_type text_size = 0;
+  for (R_xlen_t i = 0; i < n_strings; i++)
+    text_size += strings[i].size() + 1;
+  std::vector<R_xlen_t> shard_begin(1, 0);
+  size_type prefix_size = 0;
+  R_xlen_t i = 0;
+  for (int k = 1; k < n_shards; k++) {
+    while (i < n_strings && prefix_size * n_shards < text_size * k)
+      prefix_size += strings[i++].size() + 1;
+    // Every shard gets at least one string
+    shard_begin.push_back(std::min(
+      std::max(i, shard_begin.back() + 1), n_strings - (n_shards - k)
+    ));
+  }
+  shard_begin.push_back(n_strings);
+
+  std::vector<SegmentText> texts;
+  texts.reserve(n_shards);
+  std::vector< std::shared_ptr<Segment> > segments;
+  for (int i = 0; i < n_shards; i++) {
+    texts.emplace_back(strings, shard_begin[i], shard_begin[i + 1], temp_dir);
+    segments.push_back(create_segment(profile));
+  }
+  // Sorting of suffixes and building the wavelet tree are parallelized
+  // within each shard with the threads left over
+  const int shard_threads = std::max(n_threads / n_shards, 1);
+  parallel_for(n_shards, n_threads, [&](size_t i) {
+    SaAlgorithm sa_algorithm(
+      !temp_dir.empty() ? sdsl::SE_SAIS :
+        shard_threads > 1 ? sdsl::PARALLEL_LIBDIVSUFSORT : sdsl::LIBDIVSUFSORT,
+      temp_dir.empty() ? shard_threads : 1
+    );
+    segments[i]->build(texts[i], options);
+    texts[i].text = std::string();
+    texts[i].disk.reset();
+  });
+  return new FMIndex(profile, std::move(segments), n_shards);
+}
+
+void FMIndex::append(const CharacterVector& strings, double merge_threshold, bool background) {
+  if (strings.size() == 0)
+    return;
+  // A failed background merge is reported before anything is appended
+  if (!merging)
+    join_merge();
+  const SegmentText text(strings, 0, strings.size(), "");
+  auto appended = create_segment(profile);
+  appended->build(text, snapshot()->segments.back()->options());
+  std::shared_ptr<const SegmentList> list;
+  {
+    std::lock_guard<std::mutex> lock(segments_mutex);
+    auto segments_ = segments->segments;
+    segments_.push_back(appended);
+    list = segments = std::make_shared<const SegmentList>(
+      std::move(segments_), segments->n_shards, segments->tombstones
+    );
+  }
+  if (merging)
+    return;
+  size_type appended_size = 0;
+  for (size_t i = list->n_shards; i < list->segments.size(); i++)
+    appended_size += list->segments[i]->size();
+  if (appended_size <= merge_threshold * list->segments[list->n_shards - 1]->size())
+    return;
+  if (merge_thread.joinable())
+    merge_thread.join();
+  // A merge that failed while these strings were appended is reported by the
+  // next call instead of retried
+  if (merge_error)
+    return;
+  // Created here, creating segments may raise R errors
+  auto target = create_segment(profile);
+  merging = true;
+  if (background) {
+    merge_thread = std::thread(&FMIndex::merge, this, list, target);
+    return;
+  }
+  merge(list, target);
+  if (merge_error) {
+    const auto error = merge_error;
+    merge_error = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+
+// Tombstones of a segment rebuilt without the text of the strings deleted in
+// erased. Strings deleted since then, in current, are still in the text.
+std::shared_ptr<const Tombstones> rebuilt_tombstones(
+  const Segment& rebuilt, const Tombstones& erased, const Tombstones& current
+) {
+  auto tombstones = std::make_shared<Tombstones>(current.size());
+  for (Tombstones::size_type doc = 0; doc < current.size(); doc++) {
+    if (current.is_deleted(doc))
+      tombstones->erase(doc, erased.is_deleted(doc) ? 0 : rebuilt.document_size(doc));
+  }
+  return tombstones;
+}
+
+// Tombstones of the segments [first, last) of list, concatenated
+Tombstones concat_tombstones(const FMIndex::TombstoneList& list, size_t first, size_t last) {
+  std::vector<const Tombstones*> parts;
+  for (size_t i = first; i < last; i++)
+    parts.push_back(list[i].get());
+  return Tombstones(parts);
+}
+
+// Rebuilds the last shard of merged together with all appended segments of
+// merged as target, then replaces them with target. Segments appended in the
+// meantime stay in place. The text of deleted strings is left out. Runs
+// without touching R objects, failures are kept in merge_error.
+void FMIndex::merge(std::shared_ptr<const SegmentList> merged, std::shared_ptr<Segment> target) {
+  const auto first = merged->n_shards - 1;
+  const auto last = merged->segments.size();
+  try {
+    SegmentText text;
+    for (size_t i = first; i < last; i++)
+      merged->segments[i]->extract(text);
+    const auto erased = concat_tombstones(merged->tombstones, first, last);
+    text.clear_documents(erased);
+    target->build(text, merged->segments[first]->options());
+    std::lock_guard<std::mutex> lock(segments_mutex);
+    auto segments_ = segments->segments;
+    segments_.erase(segments_.begin() + first, segments_.begin() + last);
+    segments_.insert(segments_.begin() + first, target);
+    auto tombstones = segments->tombstones;
+    const auto target_tombstones = rebuilt_tombstones(
+      *target, erased, concat_tombstones(tombstones, first, last)
+    );
+    tombstones.erase(tombstones.begin() + first, tombstones.begin() + last);
+    tombstones.insert(tombstones.begin() + first, target_tombstones);
+    segments = std::make_shared<const SegmentList>(
+      std::move(segments_), merged->n_shards, std::move(tombstones)
+    );
+  } catch (...) {
+    // The appended segments stay in use
+    merge_error = std::current_exception();
+  }
+  merging = false;
+}
+
+void FMIndex::erase(const std::vector<size_type>& documents) {
+  std::lock_guard<std::mutex> lock(segments_mutex);
+  auto tombstones = segments->tombstones;
+  // Tombstones of every segment are copied once, the first time one of its
+  // strings is deleted
+  std::vector<std::shared_ptr<Tombstones>> modified(tombstones.size());
+  for (const auto& doc: documents) {
+    const auto i = find_segment(*segments, doc);
+    if (!modified[i]) {
+      modified[i] = std::make_shared<Tombstones>(*tombstones[i]);
+      tombstones[i] = modified[i];
+    }
+    const auto segment_doc = doc - segments->first_document[i];
+    modified[i]->erase(segment_doc, segments->segments[i]->document_size(segment_doc));
+  }
+  segments = std::make_shared<const SegmentList>(
+    segments->segments, segments->n_shards, std::move(tombstones)
+  );
+}
+
+void FMIndex::compact(double max_deleted, int n_threads) {
+  // The segment list must not change until compaction is finished
+  join_merge();
+  const auto list = snapshot();
+  std::vector<size_t> compacted;
+  std::vector< std::shared_ptr<Segment> > targets;
+  for (size_t i = 0; i < list->segments.size(); i++) {
+    if (list->tombstones[i]->pending_size() > max_deleted * list->segments[i]->size()) {
+      compacted.push_back(i);
+      targets.push_back(create_segment(profile));
+    }
+  }
+  if (compacted.empty())
+    return;
+  n_threads = std::max(n_threads, 1);
+  const int segment_threads = std::max<int>(n_threads / compacted.size(), 1);
+  parallel_for(compacted.size(), n_threads, [&](size_t k) {
+    const auto i = compacted[k];
+    SaAlgorithm sa_algorithm(
+      segment_threads > 1 ? sdsl::PARALLEL_LIBDIVSUFSORT : sdsl::LIBDIVSUFSORT,
+      segment_threads
+    );
+    SegmentText text;
+    list->segments[i]->extract(text);
+    text.clear_documents(*list->tombstones[i]);
+    targets[k]->build(text, list->segments[i]->options());
+  });
+  auto segments_ = list->segments;
+  auto tombstones = list->tombstones;
+  for (size_t k = 0; k < compacted.size(); k++) {
+    const auto i = compacted[k];
+    segments_[i] = targets[k];
+    tombstones[i] = rebuilt_tombstones(*targets[k], *tombstones[i], *tombstones[i]);
+  }
+  std::lock_guard<std::mutex> lock(segments_mutex);
+  segments = std::make_shared<const SegmentList>(
+    std::move(segments_), list->n_shards, std::move(tombstones)
+  );
+}
+
+// Sorts pattern indices by the reversed text of their patterns with a most
+// significant digit radix sort, which looks at every character at most once
+// instead of comparing shared suffixes over and over
+void sort_by_reversed_text(
+  const std::vector<std::string>& patterns, std::vector<size_t>& order
+) {
+  struct Bucket {
+    size_t begin, end, depth;
+  };
+  std::vector<Bucket> stack{{0, order.size(), 0}};
+  std::vector<size_t> buffer(order.size());
+  // Patterns ending before depth sort first
+  auto key = [&](size_t i, size_t depth) -> int {
+    const auto& pattern = patterns[i];
+    return depth < pattern.size() ? static_cast<unsigned char>(pattern[pattern.size() - 1 - depth]) + 1 : 0;
+  };
+  std::vector<size_t> counts(257);
+  while (!stack.empty()) {
+    const auto b = stack.back();
+    stack.pop_back();
+    if (b.end - b.begin < 32) {
+      std::sort(order.begin() + b.begin, order.begin() + b.end, [&](size_t x, size_t y) {
+        const auto& p = patterns[x], & q = patterns[y];
+        return std::lexicographical_compare(
+          p.rbegin() + std::min(b.depth, p.size()), p.rend(),
+          q.rbegin() + std::min(b.depth, q.size()), q.rend()
+        );
+      });
+      continue;
+    }
+    std::fill(counts.begin(), counts.end(), 0);
+    for (auto j = b.begin; j < b.end; j++)
+      counts[key(order[j], b.depth)]++;
+    // Bucket 0 is sorted already, as its patterns are all equal
+    auto offset = b.begin + counts[0];
+    for (size_t c = 1; c < counts.size(); c++) {
+      const auto n = counts[c];
+      counts[c] = offset;
+      if (n > 1)
+        stack.push_back({offset, offset + n, b.depth + 1});
+      offset += n;
+    }
+    counts[0] = b.begin;
+    for (auto j = b.begin; j < b.end; j++)
+      buffer[counts[key(order[j], b.depth)]++] = order[j];
+    std::copy(buffer.begin() + b.begin, buffer.begin() + b.end, order.begin() + b.begin);
+  }
+}
+
+// Patterns are searched in batches of consecutive patterns in the order of
+// their reversed text. Batches break up sharing of suffixes, so there are
+// only as many as needed to keep all threads busy.
+const size_t search_batches_per_thread = 4;
+
+// Finds the suffix array rows of every pattern in every segment. Results
+// are stored at pattern index * number of segments + segment index.
+void FMIndex::search(
+  const SegmentList& list, const std::vector<std::string>& patterns, Anchor anchor,
+  int n_threads, std::vector<SegmentHits>& hits, std::vector<size_t>* duplicate_of
+) const {
+  const auto& segments = list.segments;
+  const size_t n_segments = segments.size();
+  hits.assign(patterns.size() * n_segments, SegmentHits());
+  std::vector<size_t> order;
+  for (size_t i = 0; i < patterns.size(); i++) {
+    if (is_searchable(patterns[i]))
+      order.push_back(i);
+  }
+  // Duplicate patterns end up next to each other and share all their rows
+  sort_by_reversed_text(patterns, order);
+  if (duplicate_of) {
+    duplicate_of->resize(patterns.size());
+    std::iota(duplicate_of->begin(), duplicate_of->end(), 0);
+    for (size_t j = 1; j < order.size(); j++) {
+      if (patterns[order[j]] == patterns[order[j - 1]])
+        (*duplicate_of)[order[j]] = (*duplicate_of)[order[j - 1]];
+    }
+  }
+  const size_t n_batches = std::max<size_t>(std::min<size_t>(
+    order.size(), search_batches_per_thread * std::max(n_threads, 1) / n_segments
+  ), 1);
+  const size_t batch_size = (order.size() + n_batches - 1) / n_batches;
+  parallel_for(n_batches * n_segments, n_threads, [&](size_t i) {
+    const auto begin = std::min(i / n_segments * batch_size, order.size());
+    const auto end = std::min(begin + batch_size, order.size());
+    std::vector<const std::string*> batch;
+    for (auto j = begin; j < end; j++)
+      batch.push_back(&patterns[order[j]]);
+    std::vector<SegmentHits> batch_hits;
+    segments[i % n_segments]->find_sorted(batch, anchor, batch_hits);
+    for (auto j = begin; j < end; j++)
+      hits[order[j] * n_segments + i % n_segments] = batch_hits[j - begin];
+  });
+}
+
+// Number of hits located in one go by a worker thread. Patterns with many
+// hits are split into several chunks so that a single very frequent pattern
+// is spread over all threads.
+const size_t locate_chunk_size = 1024;
+
+DataFrame FMIndex::locate(
+  const CharacterVector& patterns, Anchor anchor, const HitContext& context,
+  int n_threads
+) const {
+  const auto list = snapshot();
+  const auto& segments = list->segments;
+  const auto& first_document = list->first_document;
+  // Worker threads must not touch R objects, copy patterns up front
+  const auto patterns_ = as< std::vector<std::string> >(patterns);
+  const size_t n_patterns = patterns_.size();
+  const size_t n_segments = segments.size();
+  // First pass: find the suffix array ranges of every pattern
+  std::vector<SegmentHits> hits;
+  std::vector<size_t> duplicate_of;
+  search(*list, patterns_, anchor, n_threads, hits, &duplicate_of);
+  // Results of every pattern go into a fixed slice of the output vectors,
+  // ordered by segment
+  struct LocateChunk {
+    size_t pattern_idx;
+    size_t segment_idx;
+    size_type range_begin;
+    size_type n;
+    size_type toehold;
+    bool shifted;
+    // Includes the hit at the start of the first string of the segment
+    bool first_document;
+    size_t out_offset;
+    // Hits not in deleted strings, written to the start of the slice
+    size_type n_kept;
+    // Chunk of the first equal pattern, whose hits are copied instead of
+    // located again, or the chunk itself
+    size_t source;
+  };
+  std::vector<LocateChunk> chunks;
+  // First chunk of every pattern and segment
+  std::vector<size_t> first_chunks(n_patterns * n_segments);
+  size_t n_total = 0;
+  for (size_t i = 0; i < n_patterns * n_segments; i++) {
+    const auto& x = hits[i];
+    first_chunks[i] = chunks.size();
+    const auto source = duplicate_of[i / n_segments] * n_segments + i % n_segments;
+    // Ranges located from their toehold are not split
+    const size_type chunk_size = segments[i % n_segments]->locates_rows() ?
+      locate_chunk_size : x.size();
+    for (size_type j = 0, k = 0; j < x.size(); j += chunk_size, k++) {
+      const bool first_document = j == 0 && x.first_document;
+      const auto row = j == 0 ? 0 : j - x.first_document;
+      chunks.push_back({
+        i / n_segments, i % n_segments, x.range_begin + row,
+        std::min<size_type>(chunk_size, x.size() - j) - first_document,
+        x.toehold, x.shifted, first_document, n_total + j, 0,
+        source == i ? chunks.size() : first_chunks[source] + k
+      });
+    }
+    n_total += x.size();
+  }
+  // Positions within a string always fit, R strings are shorter than 2^31
+  IndexVector pattern_indices(n_total, n_patterns);
+  IndexVector library_indices(n_total, first_document.back());
+  IndexVector positions(n_total, INT_MAX);
+  std::vector<std::string> left_context, right_context;
+  if (context.enabled) {
+    left_context.resize(n_total);
+    right_context.resize(n_total);
+  }
+  // Second pass: resolve every hit and write it directly to its output slot,
+  // dropping hits in deleted strings right away
+  parallel_for(chunks.size(), n_threads, [&](size_t i) {
+    auto& chunk = chunks[i];
+    if (chunk.source != i)
+      return;
+    const auto& segment = *segments[chunk.segment_idx];
+    const auto& tombstones = *list->tombstones[chunk.segment_idx];
+    const bool filter = tombstones.pending_size() > 0;
+    const auto first_document_ = first_document[chunk.segment_idx];
+    const auto pattern_size = patterns_[chunk.pattern_idx].size();
+    std::string left;
+    auto add = [&](size_type library_index, size_type position) {
+      if (filter && tombstones.is_deleted(library_index))
+        return;
+      const size_t out = chunk.out_offset + chunk.n_kept++;
+      pattern_indices.set(out, chunk.pattern_idx + 1);
+      library_indices.set(out, first_document_ + library_index + 1);
+      positions.set(out, position + 1);
+      if (!context.enabled)
+        return;
+      if (!segment.locates_rows() && !chunk.shifted) {
+        const auto length = std::min(context.left, position);
+        segment.substring(library_index, position - length, length, left);
+      }
+      left_context[out].swap(left);
+      trim_utf8_left(left_context[out]);
+      const auto begin = position + pattern_size;
+      segment.substring(
+        library_index, begin,
+        std::min(context.right, segment.document_size(library_index) - begin),
+        right_context[out]
       );
-      auto position = location;
-      if (library_index > 0)
-        position -= boundaries[library_index - 1];
-      pattern_indices[i_total] = pattern_idx + 1;
-      library_indices[i_total] = library_index + 1;
-      positions[i_total] = position + 1;
-      i_total++;
+      trim_utf8_right(right_context[out]);
+    };
+    if (chunk.first_document)
+      add(0, 0);
+    // Shifted rows point at the separator ending the preceding string, their
+    // hits have no left context
+    if (context.enabled && !chunk.shifted && segment.locates_rows()) {
+      for (size_type j = 0; j < chunk.n; j++) {
+        size_type library_index, position;
+        segment.locate_context(chunk.range_begin + j, context.left, library_index, position, left);
+        add(library_index, position);
+      }
+      return;
+    }
+    std::vector< std::pair<size_type, size_type> > located;
+    segment.locate_range(chunk.range_begin, chunk.n, chunk.toehold, located);
+    for (const auto& x: located) {
+      if (chunk.shifted)
+        add(x.first + 1, 0);
+      else
+        add(x.first, x.second);
+    }
+  });
+  // Chunks of duplicate patterns copy the kept hits of the first one
+  parallel_for(chunks.size(), n_threads, [&](size_t i) {
+    auto& chunk = chunks[i];
+    if (chunk.source == i)
+      return;
+    const auto& source = chunks[chunk.source];
+    chunk.n_kept = source.n_kept;
+    for (size_type j = 0; j < chunk.n_kept; j++) {
+      const auto from = source.out_offset + j, to = chunk.out_offset + j;
+      pattern_indices.set(to, chunk.pattern_idx + 1);
+      library_indices.copy(from, to);
+      positions.copy(from, to);
+      if (context.enabled) {
+        left_context[to] = left_context[from];
+        right_context[to] = right_context[from];
+      }
     }
+  });
+  // Close the gaps left by dropped hits at the end of chunks
+  size_t n_kept = 0;
+  for (const auto& chunk: chunks) {
+    for (size_type j = 0; j < chunk.n_kept; j++, n_kept++) {
+      if (chunk.out_offset + j == n_kept)
+        continue;
+      pattern_indices.copy(chunk.out_offset + j, n_kept);
+      library_indices.copy(chunk.out_offset + j, n_kept);
+      positions.copy(chunk.out_offset + j, n_kept);
+      if (context.enabled) {
+        left_context[n_kept].swap(left_context[chunk.out_offset + j]);
+        right_context[n_kept].swap(right_context[chunk.out_offset + j]);
+      }
+    }
+  }
+  if (n_kept < n_total) {
+    pattern_indices.truncate(n_kept);
+    library_indices.truncate(n_kept);
+    positions.truncate(n_kept);
+  }
+  if (!context.enabled) {
+    return DataFrame::create(
+      Named("pattern_index") = pattern_indices.get(),
+      Named("corpus_index") = library_indices.get(),
+      Named("position") = positions.get()
+    );
+  }
+  CharacterVector left(n_kept), right(n_kept);
+  for (size_t i = 0; i < n_kept; i++) {
+    left[i] = String(left_context[i], CE_UTF8);
+    right[i] = String(right_context[i], CE_UTF8);
   }
   return DataFrame::create(
-    Named("pattern_index") = pattern_indices,
-    Named("corpus_index") = library_indices,
-    Named("position") = positions
+    Named("pattern_index") = pattern_indices.get(),
+    Named("corpus_index") = library_indices.get(),
+    Named("position") = positions.get(),
+    Named("left") = left,
+    Named("right") = right
   );
 }
 
-void FMIndex::load_file(const String& path) {
-  std::ifstream in_file(path, std::ios::binary);
-  cereal::BinaryInputArchive archive(in_file);
-  archive(*this);
+// Locates the suffix array ranges that find(pattern index, segment, ranges)
+// appends for every pattern and segment. Every start position is reported
+// once, with the closest and then shortest match starting there.
+template<class F>
+DataFrame FMIndex::locate_ranges(
+  const SegmentList& list, size_t n_patterns, int n_threads, bool with_distance, F find
+) const {
+  const auto& segments = list.segments;
+  const auto& first_document = list.first_document;
+  const size_t n_segments = segments.size();
+  struct RangeHit {
+    size_type document, position, length, distance;
+  };
+  std::vector< std::vector<RangeHit> > hits(n_patterns * n_segments);
+  parallel_for(n_patterns * n_segments, n_threads, [&](size_t i) {
+    const auto& segment = *segments[i % n_segments];
+    const auto& tombstones = *list.tombstones[i % n_segments];
+    const bool filter = tombstones.pending_size() > 0;
+    std::vector<ApproximateRange> ranges;
+    find(i / n_segments, segment, ranges);
+    // Searches may find a substring several times, and substrings with the
+    // same occurrences share their range. Locate every range once.
+    std::sort(ranges.begin(), ranges.end(), [](const ApproximateRange& a, const ApproximateRange& b) {
+      return std::tie(a.range_begin, a.n, a.distance, a.length) <
+        std::tie(b.range_begin, b.n, b.distance, b.length);
+    });
+    ranges.erase(std::unique(ranges.begin(), ranges.end(), [](const ApproximateRange& a, const ApproximateRange& b) {
+      return a.range_begin == b.range_begin && a.n == b.n;
+    }), ranges.end());
+    auto& x = hits[i];
+    std::vector< std::pair<size_type, size_type> > located;
+    for (const auto& range: ranges) {
+      // Approximate ranges have no toehold, only segments locating single
+      // rows support approximate searches
+      segment.locate_range(range.range_begin, range.n, 0, located);
+      for (const auto& y: located) {
+        if (!filter || !tombstones.is_deleted(y.first))
+          x.push_back({y.first, y.second, range.length, range.distance});
+      }
+    }
+    std::sort(x.begin(), x.end(), [](const RangeHit& a, const RangeHit& b) {
+      return std::tie(a.document, a.position, a.distance, a.length) <
+        std::tie(b.document, b.position, b.distance, b.length);
+    });
+    x.erase(std::unique(x.begin(), x.end(), [](const RangeHit& a, const RangeHit& b) {
+      return a.document == b.document && a.position == b.position;
+    }), x.end());
+  });
+  size_t n_total = 0;
+  for (const auto& x: hits)
+    n_total += x.size();
+  IndexVector pattern_indices(n_total, n_patterns);
+  IndexVector library_indices(n_total, first_document.back());
+  IntegerVector positions(n_total), lengths(n_total), distances(n_total);
+  size_t out = 0;
+  for (size_t i = 0; i < n_patterns * n_segments; i++) {
+    for (const auto& x: hits[i]) {
+      pattern_indices.set(out, i / n_segments + 1);
+      library_indices.set(out, first_document[i % n_segments] + x.document + 1);
+      positions[out] = x.position + 1;
+      lengths[out] = x.length;
+      distances[out] = x.distance;
+      out++;
+    }
+  }
+  if (!with_distance) {
+    return DataFrame::create(
+      Named("pattern_index") = pattern_indices.get(),
+      Named("corpus_index") = library_indices.get(),
+      Named("position") = positions,
+      Named("length") = lengths
+    );
+  }
+  return DataFrame::create(
+    Named("pattern_index") = pattern_indices.get(),
+    Named("corpus_index") = library_indices.get(),
+    Named("position") = positions,
+    Named("length") = lengths,
+    Named("distance") = distances
+  );
 }
 
-void FMIndex::save_file(const String& path) {
-  std::ofstream out_file(path, std::ios::binary);
-  cereal::BinaryOutputArchive archive(out_file);
-  archive(*this);
+DataFrame FMIndex::locate_approximate(
+  const CharacterVector& patterns, size_type max_distance, Metric metric,
+  int n_threads
+) const {
+  if (profile == Profile::repetitive)
+    stop("Approximate search is not supported by the repetitive profile");
+  const auto list = snapshot();
+  const auto patterns_ = as< std::vector<std::string> >(patterns);
+  return locate_ranges(*list, patterns_.size(), n_threads, true, [&](
+    size_t pattern_idx, const Segment& segment, std::vector<ApproximateRange>& ranges
+  ) {
+    const auto& pattern = patterns_[pattern_idx];
+    if (is_searchable(pattern))
+      segment.find_approximate(pattern, max_distance, metric, ranges);
+  });
 }
 
-List wrap_index(FMIndex* index) {
-  XPtr<FMIndex> index_ptr(index);
+// Patterns are parsed up front, so that syntax errors are raised before any
+// search starts
+DataFrame FMIndex::locate_pattern(const CharacterVector& patterns, int n_threads) const {
+  if (profile == Profile::repetitive)
+    stop("Pattern search is not supported by the repetitive profile");
+  const auto list = snapshot();
+  std::vector< std::vector<PatternElement> > parsed;
+  for (const auto& pattern: as< std::vector<std::string> >(patterns)) {
+    try {
+      parsed.push_back(parse_pattern(pattern, document_separator));
+    } catch (const std::invalid_argument& e) {
+      stop(e.what());
+    }
+  }
+  return locate_ranges(*list, parsed.size(), n_threads, false, [&](
+    size_t pattern_idx, const Segment& segment, std::vector<ApproximateRange>& ranges
+  ) {
+    if (!parsed[pattern_idx].empty())
+      segment.find_pattern(parsed[pattern_idx], ranges);
+  });
+}
+
+// Number of hits outside of deleted strings. With document listing support,
+// hits only need to be located if one of the strings containing them is
+// deleted. Shifted rows belong to the string preceding that of their hit.
+Segment::size_type count_live_hits(
+  const Segment& segment, const Tombstones& tombstones, const SegmentHits& hits
+) {
+  const Segment::size_type shift = hits.shifted;
+  const Segment::size_type n_first = hits.first_document && !tombstones.is_deleted(0);
+  std::vector< std::pair<Segment::size_type, Segment::size_type> > documents;
+  if (segment.options().document_listing) {
+    segment.documents(hits.range_begin, hits.n, hits.toehold, false, documents);
+    if (std::none_of(documents.begin(), documents.end(), [&](const auto& x) {
+      return tombstones.is_deleted(x.first + shift);
+    }))
+      return hits.n + n_first;
+    documents.clear();
+  }
+  segment.documents(hits.range_begin, hits.n, hits.toehold, true, documents);
+  Segment::size_type n_live = n_first;
+  for (const auto& x: documents) {
+    if (!tombstones.is_deleted(x.first + shift))
+      n_live += x.second;
+  }
+  return n_live;
+}
+
+RObject FMIndex::count(const CharacterVector& patterns, Anchor anchor, int n_threads) const {
+  const auto list = snapshot();
+  const auto& segments = list->segments;
+  const auto patterns_ = as< std::vector<std::string> >(patterns);
+  const size_t n_patterns = patterns_.size();
+  const size_t n_segments = segments.size();
+  std::vector<SegmentHits> hits;
+  search(*list, patterns_, anchor, n_threads, hits);
+  std::vector<size_type> segment_counts(n_patterns * n_segments);
+  // Only the suffix array range is needed, SA samples are never accessed
+  // unless hits in deleted strings have to be filtered
+  parallel_for(n_patterns * n_segments, n_threads, [&](size_t i) {
+    const auto& tombstones = *list->tombstones[i % n_segments];
+    segment_counts[i] = tombstones.pending_size() == 0 || hits[i].size() == 0 ?
+      hits[i].size() : count_live_hits(*segments[i % n_segments], tombstones, hits[i]);
+  });
+  std::vector<size_type> counts_(n_patterns);
+  for (size_t i = 0; i < n_patterns * n_segments; i++)
+    counts_[i / n_segments] += segment_counts[i];
+  const auto max_count = n_patterns > 0 ? *std::max_element(counts_.begin(), counts_.end()) : 0;
+  IndexVector counts(n_patterns, max_count);
+  for (size_t i = 0; i < n_patterns; i++)
+    counts.set(i, counts_[i]);
+  return counts.get();
+}
+
+CharacterVector FMIndex::extract(
+  const std::vector<size_type>& documents, const std::vector<std::int64_t>& starts,
+  const std::vector<std::int64_t>& ends, int n_threads
+) const {
+  const auto list = snapshot();
+  const size_t n = documents.size();
+  std::vector<std::string> texts(n);
+  std::vector<char> missing(n, 0);
+  parallel_for(n, n_threads, [&](size_t i) {
+    if (documents[i] == missing_document) {
+      missing[i] = 1;
+      return;
+    }
+    const auto segment_idx = find_segment(*list, documents[i]);
+    const auto doc = documents[i] - list->first_document[segment_idx];
+    if (list->tombstones[segment_idx]->is_deleted(doc)) {
+      missing[i] = 1;
+      return;
+    }
+    const auto& segment = *list->segments[segment_idx];
+    const std::int64_t size = segment.document_size(doc);
+    const auto from = std::max<std::int64_t>(starts[i] < 0 ? size + starts[i] + 1 : starts[i], 1);
+    const auto to = std::min<std::int64_t>(ends[i] < 0 ? size + ends[i] + 1 : ends[i], size);
+    if (from <= to)
+      segment.substring(doc, from - 1, to - from + 1, texts[i]);
+  });
+  CharacterVector result(n);
+  for (size_t i = 0; i < n; i++) {
+    if (missing[i])
+      result[i] = NA_STRING;
+    else
+      result[i] = String(texts[i], CE_UTF8);
+    // Release the decoded text early, the corpus may be large
+    std::string().swap(texts[i]);
+  }
+  return result;
+}
+
+DataFrame FMIndex::documents(const CharacterVector& patterns, bool counts, int n_threads) const {
+  const auto list = snapshot();
+  const auto& segments = list->segments;
+  const auto& first_document = list->first_document;
+  const auto patterns_ = as< std::vector<std::string> >(patterns);
+  const size_t n_patterns = patterns_.size();
+  const size_t n_segments = segments.size();
+  std::vector<SegmentHits> ranges;
+  search(*list, patterns_, Anchor::none, n_threads, ranges);
+  // Corpus strings and their number of hits for every pattern and segment
+  std::vector< std::vector< std::pair<size_type, size_type> > > hits(n_patterns * n_segments);
+  parallel_for(n_patterns * n_segments, n_threads, [&](size_t i) {
+    const auto& x = ranges[i];
+    segments[i % n_segments]->documents(x.range_begin, x.n, x.toehold, counts, hits[i]);
+    const auto& tombstones = *list->tombstones[i % n_segments];
+    if (tombstones.pending_size() > 0) {
+      hits[i].erase(std::remove_if(hits[i].begin(), hits[i].end(), [&](const auto& x) {
+        return tombstones.is_deleted(x.first);
+      }), hits[i].end());
+    }
+  });
+  size_t n_total = 0;
+  size_type max_count = 0;
+  for (const auto& x: hits) {
+    n_total += x.size();
+    for (const auto& y: x)
+      max_count = std::max(max_count, y.second);
+  }
+  IndexVector pattern_indices(n_total, n_patterns);
+  IndexVector library_indices(n_total, first_document.back());
+  IndexVector hit_counts(counts ? n_total : 0, max_count);
+  // Segments cover consecutive corpus strings, so results stay sorted
+  size_t out = 0;
+  for (size_t i = 0; i < n_patterns * n_segments; i++) {
+    for (const auto& x: hits[i]) {
+      pattern_indices.set(out, i / n_segments + 1);
+      library_indices.set(out, first_document[i % n_segments] + x.first + 1);
+      if (counts)
+        hit_counts.set(out, x.second);
+      out++;
+    }
+  }
+  if (!counts)
+    return DataFrame::create(
+      Named("pattern_index") = pattern_indices.get(),
+      Named("corpus_index") = library_indices.get()
+    );
+  return DataFrame::create(
+    Named("pattern_index") = pattern_indices.get(),
+    Named("corpus_index") = library_indices.get(),
+    Named("n") = hit_counts.get()
+  );
+}
+
+// Index file opened for reading, either from a stream or mapped into memory
+class IndexFileReader {
+public:
+  IndexFileReader(const std::string& path, bool mmap);
+  cereal::AlignedInputArchive& archive() { return *archive_; };
+  // Reads the file format version, profile and number of shard files
+  std::uint32_t read_header(Profile& profile);
+  std::shared_ptr<MappedFile> mapping;
+private:
+  std::ifstream in_file;
+  std::unique_ptr<cereal::AlignedInputArchive> archive_;
+};
+
+IndexFileReader::IndexFileReader(const std::string& path, bool mmap) :
+  in_file(path, std::ios::binary)
+{
+  if (!in_file)
+    stop("Could not open file " + path);
+  char magic[sizeof(file_magic)];
+  in_file.read(magic, sizeof(magic));
+  if (!in_file || !std::equal(magic, magic + sizeof(magic), file_magic))
+    stop("Not an FM Index file or created by an older version of fm.index, please re-create the index");
+  if (!mmap) {
+    archive_.reset(new cereal::AlignedInputArchive(in_file));
+    return;
+  }
+  in_file.close();
+  // The magic tag keeps the archive aligned within the page aligned mapping
+  mapping = std::make_shared<MappedFile>(path);
+  archive_.reset(new cereal::AlignedInputArchive(
+    mapping->data() + sizeof(file_magic), mapping->data() + mapping->size()
+  ));
+}
+
+std::uint32_t IndexFileReader::read_header(Profile& profile) {
+  std::uint32_t version;
+  archive()(version);
+  if (version != file_format_version)
+    stop("Index file was created by an incompatible version of fm.index, please re-create the index");
+  std::uint32_t profile_id, n_shard_files;
+  archive()(profile_id, n_shard_files);
+  profile = static_cast<Profile>(profile_id);
+  return n_shard_files;
+}
+
+// Shard files are stored next to the main index file, which refers to them
+// by file name
+std::string file_directory(const std::string& path) {
+  const auto separator = path.find_last_of("/\\");
+  return separator == std::string::npos ? "" : path.substr(0, separator + 1);
+}
+
+FMIndex* FMIndex::load_file(const String& path, bool mmap) {
+  IndexFileReader file(path, mmap);
+  Profile profile;
+  const auto n_shard_files = file.read_header(profile);
+  std::vector< std::shared_ptr<Segment> > segments;
+  TombstoneList tombstones;
+  // Every segment is followed by its tombstones
+  auto load_segment = [&](IndexFileReader& segment_file) {
+    segments.push_back(create_segment(profile));
+    // Set first, a segment failing to load still has to release its vectors
+    // into the mapping
+    segments.back()->mapping = segment_file.mapping;
+    segments.back()->load(segment_file.archive());
+    auto segment_tombstones = std::make_shared<Tombstones>();
+    segment_file.archive()(*segment_tombstones);
+    if (segment_tombstones->size() != segments.back()->n_documents())
+      stop("Index file is corrupt, please re-create the index");
+    tombstones.push_back(segment_tombstones);
+  };
+  if (n_shard_files == 0) {
+    load_segment(file);
+    return new FMIndex(profile, std::move(segments), 1, std::move(tombstones));
+  }
+  // Files of the shards followed by those of appended segments
+  std::vector<std::string> names;
+  std::uint32_t n_shards;
+  file.archive()(names, n_shards);
+  if (n_shards == 0 || n_shards > names.size())
+    stop("Index file is corrupt, please re-create the index");
+  for (const auto& name: names) {
+    IndexFileReader shard_file(file_directory(path) + name, mmap);
+    Profile shard_profile;
+    if (shard_file.read_header(shard_profile) != 0 || shard_profile != profile)
+      stop("Shard file " + name + " does not match the profile of the index");
+    load_segment(shard_file);
+  }
+  return new FMIndex(profile, std::move(segments), n_shards, std::move(tombstones));
+}
+
+// Moves the finished file temp_path to path. A file already at path may be
+// mapped by a loaded index, renaming leaves its contents alone where
+// truncating it would not.
+void replace_file(const std::string& temp_path, const std::string& path) {
+  if (std::rename(temp_path.c_str(), path.c_str()) == 0)
+    return;
+  // Renaming onto an existing file fails on Windows
+  if (std::remove(path.c_str()) != 0 || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+    std::remove(temp_path.c_str());
+    stop("Could not replace file " + path);
+  }
+}
+
+// Writes an index file under a temporary name next to path and returns that
+// name, f writes everything following the header. replace_file() moves it to
+// path once complete.
+template<class F>
+std::string write_index_file(const std::string& path, Profile profile, std::uint32_t n_shard_files, F f) {
+  const auto temp_path = path + ".tmp";
+  try {
+    std::ofstream out_file(temp_path, std::ios::binary);
+    if (!out_file)
+      stop("Could not open file " + temp_path);
+    out_file.write(file_magic, sizeof(file_magic));
+    cereal::AlignedOutputArchive archive(out_file);
+    archive(file_format_version, static_cast<std::uint32_t>(profile), n_shard_files);
+    f(archive);
+    out_file.close();
+    if (!out_file)
+      stop("Could not write file " + temp_path);
+  } catch (...) {
+    std::remove(temp_path.c_str());
+    throw;
+  }
+  return temp_path;
+}
+
+// Name of shard file i (0-based) of the index file named name
+std::string shard_file_name(const std::string& name, size_t i) {
+  return name + ".shard" + std::to_string(i + 1);
+}
+
+void FMIndex::save_file(const String& path) const {
+  const auto list = snapshot();
+  const auto& segments = list->segments;
+  const std::string path_ = path;
+  const auto directory = file_directory(path_);
+  const auto name = path_.substr(directory.size());
+  // Every shard and appended segment is an index file of its own, named
+  // after the main file. All files are written before any of them replaces
+  // an existing one, the main file last.
+  std::vector<std::string> names, temp_paths;
+  try {
+    if (segments.size() == 1) {
+      temp_paths.push_back(write_index_file(path_, profile, 0, [&](cereal::AlignedOutputArchive& archive) {
+        segments[0]->save(archive);
+        archive(*list->tombstones[0]);
+      }));
+    } else {
+      for (size_t i = 0; i < segments.size(); i++) {
+        names.push_back(shard_file_name(name, i));
+        temp_paths.push_back(write_index_file(directory + names.back(), profile, 0, [&](cereal::AlignedOutputArchive& archive) {
+          segments[i]->save(archive);
+          archive(*list->tombstones[i]);
+        }));
+      }
+      temp_paths.push_back(write_index_file(path_, profile, names.size(), [&](cereal::AlignedOutputArchive& archive) {
+        archive(names, static_cast<std::uint32_t>(list->n_shards));
+      }));
+    }
+  } catch (...) {
+    for (const auto& temp_path: temp_paths)
+      std::remove(temp_path.c_str());
+    throw;
+  }
+  // The main file replaces the existing one last
+  names.push_back(name);
+  for (size_t i = 0; i < names.size(); i++) {
+    try {
+      replace_file(temp_paths[i], directory + names[i]);
+    } catch (...) {
+      for (size_t j = i + 1; j < temp_paths.size(); j++)
+        std::remove(temp_paths[j].c_str());
+      throw;
+    }
+  }
+  // Shard files left over from saving more segments to the same path before
+  auto i = segments.size() == 1 ? 0 : segments.size();
+  while (std::remove((directory + shard_file_name(name, i)).c_str()) == 0)
+    i++;
+}
+
+// R representation of the index behind the external pointer index_ptr
+List describe_index(SEXP index_ptr, const FMIndex& index) {
   auto wrapped = List::create(
     Named("index") = index_ptr,
-    Named("n") = index->boundaries.size(),
-    Named("n_bytes") = index->index.size()
+    Named("n") = index.n_documents(),
+    Named("n_bytes") = index.size(),
+    Named("profile") = profile_names[static_cast<std::uint32_t>(index.profile)],
+    Named("n_shards") = index.n_shards(),
+    Named("n_deleted") = index.n_deleted()
   );
   wrapped.attr("class") = "fmindex";
   return wrapped;
 }
 
+List wrap_index(FMIndex* index) {
+  XPtr<FMIndex> index_ptr(index);
+  return describe_index(index_ptr, *index);
+}
+
 FMIndex* unwrap_index(const List& index) {
   if (as<std::string>(index.attr("class")) != "fmindex")
     stop("Not an FMIndex");
@@ -125,8 +2247,58 @@ FMIndex* unwrap_index(const List& index) {
 //' sets of strings (corpus). Searches for partial matches with the corpus are
 //' extremely fast.
 //'
+//' Corpus strings are indexed separately, matches never span two
+//' neighbouring strings. Strings must not contain the ASCII control
+//' character 0x01, which is used internally to separate them.
+//'
 //' @param strings Vector of strings (corpus) to construct FM index from
 //' @param case_sensitive Build case-sensitive index if TRUE
+//' @param document_listing Build additional data structure that speeds up
+//'   [fm_index_documents()], at the cost of about two bits per character of
+//'   the corpus.
+//' @param profile Tradeoff between memory use and the speed of locating
+//'   matches. `"default"` samples every 32nd suffix array value. `"fast"`
+//'   samples every 4th value, making [fm_index_locate()] several times faster
+//'   at the cost of about two additional bytes per character of the corpus.
+//'   `"small"` compresses the index and samples only every 128th value,
+//'   suited for large corpora that are rarely searched. `"repetitive"` builds
+//'   an r-index, whose size depends on the number of runs of equal
+//'   characters in the Burrows-Wheeler transform rather than on the size of
+//'   the corpus, for highly repetitive corpora such as versions of a document
+//'   or genomes of one species. Every hit is located in a few steps, but
+//'   extracting context is slow, and it does not support approximate or
+//'   pattern search, `document_listing`, `bidirectional` or `qgram_length`.
+//'   The profile is stored when saving the index.
+//' @param temp_dir If given, the index is constructed using temporary files
+//'   in this directory instead of in memory, for corpora too large to fit
+//'   into memory several times over. Memory use during construction is then
+//'   dominated by a single additional copy of the corpus. The temporary files
+//'   take several times the size of the corpus on disk and are deleted once
+//'   construction is finished. Document listing support is always built in
+//'   memory.
+//' @param n_threads Number of threads used for sorting the suffixes of the
+//'   corpus, the most expensive step of construction, and for building the
+//'   wavelet tree. Using several threads needs about one additional byte per
+//'   character of the corpus. Only used for building shards concurrently if
+//'   `temp_dir` is given.
+//' @param n_shards Number of independent indices (shards) the corpus is split
+//'   into, each covering consecutive corpus strings of about the same total
+//'   length. Shards are built concurrently and searched concurrently, with
+//'   `n_threads` threads shared between them. [fm_index_save()] stores every
+//'   shard in a file of its own, which can be replaced by an index of the
+//'   same strings created with the same profile, for example after they have
+//'   changed. Matches never span two shards.
+//' @param bidirectional Also index the reversed corpus, which makes
+//'   [fm_index_locate_approx()] much faster, at the cost of doubling the
+//'   size of the index and the time needed for construction. Not needed for
+//'   exact searches.
+//' @param qgram_length If positive, store the suffix array ranges of all
+//'   strings of up to this many characters in a table, which saves that many
+//'   of the most expensive steps when searching every pattern. The table
+//'   has one entry per possible string over the characters of the corpus,
+//'   so the length is lowered where that would exceed one entry per 16
+//'   characters of the corpus. Useful for searching many patterns, values
+//'   of 4 to 8 suit small alphabets like DNA.
 //' @return A FM Index object that can be passed to [fm_index_locate()] for
 //'  finding matches in the corpus.
 //'
@@ -138,11 +2310,135 @@ FMIndex* unwrap_index(const List& index) {
 //' @export
 //' @importFrom stringi stri_trans_tolower
 // [[Rcpp::export]]
-List fm_index_create(CharacterVector strings, bool case_sensitive = false) {
+List fm_index_create(
+  CharacterVector strings, bool case_sensitive = false, bool document_listing = false,
+  std::string profile = "default", Nullable<String> temp_dir = R_NilValue,
+  int n_threads = 1, int n_shards = 1, bool bidirectional = false,
+  int qgram_length = 0
+) {
+  const auto profile_ = parse_profile(profile);
+  if (qgram_length < 0)
+    stop("qgram_length must not be negative");
+  if (profile_ == Profile::repetitive && (document_listing || bidirectional || qgram_length > 0))
+    stop("The repetitive profile does not support document_listing, bidirectional or qgram_length");
+  if (!case_sensitive)
+    strings = stri_trans_tolower(strings);
+  SegmentOptions options;
+  options.document_listing = document_listing;
+  options.bidirectional = bidirectional;
+  options.qgram_length = qgram_length;
+  return wrap_index(FMIndex::create(
+    strings, profile_, options,
+    temp_dir.isNull() ? "" : as<std::string>(temp_dir), n_threads, n_shards
+  ));
+}
+
+//' Append strings to an FM Index
+//'
+//' Adds strings to the corpus of an existing index without rebuilding it.
+//' The strings are indexed separately and searched together with the rest of
+//' the corpus. Once appended strings exceed `merge_threshold` times the size
+//' of the last shard of the index (the whole index, unless it was created with
+//' `n_shards`), they are merged into that shard by rebuilding it. Searches
+//' are not blocked by the merge, they use the separate indices until it is
+//' finished.
+//'
+//' @param index FM Index created with [fm_index_create()] or loaded with
+//'   [fm_index_load()]. The index is modified in place.
+//' @param strings Vector of strings to append to the corpus. Their corpus
+//'   indices follow those of the strings already in the index.
+//' @param case_sensitive Must be the same as when creating the index
+//' @param merge_threshold Size of the appended strings, relative to the last
+//'   shard, above which they are merged into the shard.
+//' @param background If TRUE, merging happens in a background thread and
+//'   the function returns immediately, otherwise it returns once merging is
+//'   finished. A merge that fails in the background raises an error from
+//'   the next call to `fm_index_append()` or [fm_index_compact()].
+//' @return The index with updated `n` and `n_bytes`.
+//'
+//' @examples
+//' data("state")
+//' index <- fm_index_create(state.name[1:40], case_sensitive = FALSE)
+//' index <- fm_index_append(index, state.name[41:50])
+//' fm_index_locate("new", index)
+//'
+//' @family FM Index functions
+//' @export
+// [[Rcpp::export]]
+List fm_index_append(
+  const List& index, CharacterVector strings, bool case_sensitive = false,
+  double merge_threshold = 0.1, bool background = true
+) {
+  auto* fm_index = unwrap_index(index);
   if (!case_sensitive)
     strings = stri_trans_tolower(strings);
-  auto* fm_index = new FMIndex(strings);
-  return wrap_index(fm_index);
+  fm_index->append(strings, merge_threshold, background);
+  return describe_index(index["index"], *fm_index);
+}
+
+//' Delete strings from an FM Index
+//'
+//' Marks corpus strings as deleted, so that they are no longer found. The
+//' remaining strings keep their corpus indices. The text of deleted strings
+//' stays in the index, and hits in it are filtered from search results,
+//' until [fm_index_compact()] rebuilds the index without it. Deletions are
+//' stored when saving the index.
+//'
+//' @inheritParams fm_index_append
+//' @param corpus_indices Indices of the strings to delete, 1-based
+//' @return The index with updated `n_deleted`.
+//'
+//' @examples
+//' data("state")
+//' index <- fm_index_create(state.name, case_sensitive = FALSE)
+//' index <- fm_index_delete(index, which(state.name == "New York"))
+//' fm_index_locate("new", index)
+//'
+//' @family FM Index functions
+//' @export
+// [[Rcpp::export]]
+List fm_index_delete(const List& index, const NumericVector& corpus_indices) {
+  auto* fm_index = unwrap_index(index);
+  const auto n_documents = fm_index->n_documents();
+  std::vector<FMIndex::size_type> documents;
+  documents.reserve(corpus_indices.size());
+  for (const auto& x: corpus_indices) {
+    if (!(x >= 1 && x <= n_documents))
+      stop("Corpus indices must be between 1 and the number of corpus strings");
+    documents.push_back(static_cast<FMIndex::size_type>(x) - 1);
+  }
+  fm_index->erase(documents);
+  return describe_index(index["index"], *fm_index);
+}
+
+//' Remove the text of deleted strings from an FM Index
+//'
+//' Rebuilds the parts of the index (shards and appended strings) in which
+//' deleted strings make up more than `max_deleted` of the indexed text,
+//' leaving out their text. This reclaims their memory and saves filtering
+//' their hits from search results. Deleted strings keep their corpus
+//' indices, which are never reused. Waits for a merge started by
+//' [fm_index_append()] to finish first.
+//'
+//' @inheritParams fm_index_append
+//' @param max_deleted Fraction of the text of a part of the index that may
+//'   belong to deleted strings without rebuilding it
+//' @param n_threads Number of threads used for rebuilding
+//' @return The index with updated `n_bytes`.
+//'
+//' @examples
+//' data("state")
+//' index <- fm_index_create(state.name, case_sensitive = FALSE)
+//' index <- fm_index_delete(index, 1:10)
+//' index <- fm_index_compact(index)
+//'
+//' @family FM Index functions
+//' @export
+// [[Rcpp::export]]
+List fm_index_compact(const List& index, double max_deleted = 0.1, int n_threads = 1) {
+  auto* fm_index = unwrap_index(index);
+  fm_index->compact(max_deleted, n_threads);
+  return describe_index(index["index"], *fm_index);
 }
 
 //' Locate given patterns
@@ -152,10 +2448,25 @@ List fm_index_create(CharacterVector strings, bool case_sensitive = false) {
 //'
 //' @param patterns Vector of strings to look for in the index
 //' @param index Index created with [fm_index_create()]
+//' @param n_threads Number of threads used for searching. Patterns and
+//'   their matches are distributed dynamically across threads. The order of
+//'   the results does not depend on the number of threads.
+//' @param anchor `"start"`, `"end"` and `"full"` only find patterns at the
+//'   start, at the end of or equal to whole corpus strings. Only these hits
+//'   are ever located, which is much faster than filtering all hits.
+//' @param context If given, the number of characters of context to return
+//'   left and right of every hit, either one number for both sides or
+//'   `c(left, right)`. Context is decoded from the index and ends at the
+//'   boundaries of the corpus string. The left context comes with locating
+//'   the hit at little extra cost. Context is counted in bytes, UTF-8
+//'   characters cut at its edges are left out.
 //' @return A data frame with three columns. `pattern_index` is the index
 //'   of the query pattern, `corpus_index` is the index of the matching
 //'   string in the corpus, and `position` is the starting position of the
-//'   match within the corpus string. All indices are 1-based.
+//'   match within the corpus string. All indices are 1-based. Index columns
+//'   are doubles instead of integers if there are more than
+//'   `.Machine$integer.max` patterns or corpus strings. With `context`,
+//'   additional columns `left` and `right` hold the context of every hit.
 //'
 //' @examples
 //' data("state")
@@ -170,11 +2481,277 @@ List fm_index_create(CharacterVector strings, bool case_sensitive = false) {
 //' hits
 //' state.name[hits$library_index]
 //'
+//' # States starting with "new"
+//' state.name[fm_index_locate("new", index, anchor = "start")$corpus_index]
+//'
+//' # Keywords in context
+//' fm_index_locate("ar", index, context = c(3, 5))
+//'
+//' @family FM Index functions
+//' @export
+// [[Rcpp::export]]
+DataFrame fm_index_locate(
+  const CharacterVector& patterns, const List& index, int n_threads = 1,
+  CharacterVector anchor = CharacterVector::create("none", "start", "end", "full"),
+  Nullable<NumericVector> context = R_NilValue
+) {
+  HitContext context_;
+  if (context.isNotNull()) {
+    const auto x = as<NumericVector>(context);
+    if (x.size() < 1 || x.size() > 2 || !(x[0] >= 0) || !(x[x.size() - 1] >= 0))
+      stop("context must be one or two non-negative numbers of characters");
+    context_.enabled = true;
+    context_.left = std::min<double>(x[0], INT_MAX);
+    context_.right = std::min<double>(x[x.size() - 1], INT_MAX);
+  }
+  return unwrap_index(index)->locate(patterns, parse_anchor(anchor), context_, n_threads);
+}
+
+//' Locate approximate matches of given patterns
+//'
+//' Finds all substrings of the corpus that differ from a pattern in at most
+//' `max_dist` characters, without enumerating variants of the pattern. The
+//' index is searched once per pattern, following only branches within the
+//' maximum distance, so the time needed grows quickly with `max_dist` but
+//' hardly with the size of the corpus. Indices created with
+//' `bidirectional = TRUE` are searched with a search scheme that starts with
+//' an exact match of a part of the pattern, which is much faster for
+//' `max_dist` above 0.
+//'
+//' @inheritParams fm_index_locate
+//' @param max_dist Maximum distance between a pattern and its matches
+//' @param metric `"hamming"` allows substitutions only, matches have the
+//'   length of the pattern. `"levenshtein"` also allows insertions and
+//'   deletions, so that matches of different length may start at the same
+//'   position. Only the closest and then shortest of them is reported.
+//' @return A data frame like for [fm_index_locate()], with additional
+//'   columns `length`, the length of the match, and `distance`, its distance
+//'   to the pattern. Hits are sorted by `corpus_index` and `position` within
+//'   each pattern.
+//'
+//' @examples
+//' data("state")
+//' index <- fm_index_create(state.name, case_sensitive = FALSE)
+//' hits <- fm_index_locate_approx("nevda", index, max_dist = 1, metric = "levenshtein")
+//' state.name[hits$corpus_index]
+//'
+//' @family FM Index functions
+//' @export
+// [[Rcpp::export]]
+DataFrame fm_index_locate_approx(
+  const CharacterVector& patterns, const List& index, int max_dist = 1,
+  CharacterVector metric = CharacterVector::create("hamming", "levenshtein"),
+  int n_threads = 1
+) {
+  if (max_dist < 0)
+    stop("max_dist must not be negative");
+  if (metric.size() == 0)
+    stop("Unknown metric");
+  const std::string metric_(metric[0]);
+  if (metric_ != "hamming" && metric_ != "levenshtein")
+    stop("Unknown metric " + metric_);
+  return unwrap_index(index)->locate_approximate(
+    patterns, max_dist, metric_ == "hamming" ? Metric::hamming : Metric::levenshtein,
+    n_threads
+  );
+}
+
+//' Locate matches of patterns with wildcards
+//'
+//' Finds all substrings of the corpus matching patterns with wildcards,
+//' character classes and bounded gaps. Patterns are matched directly in the
+//' index, following all characters allowed by a class in one step, instead of
+//' searching every string the pattern can match.
+//'
+//' Characters match themselves, except for
+//' * `?`, which matches any character,
+//' * `[...]`, which matches any of the enclosed characters or ranges of
+//'   characters like `a-z`, or any other character if it starts with `^`,
+//' * `{n}` or `{min,max}` following any of the above, which repeats it `n`
+//'   or between `min` and `max` times, like `?{0,3}` for a gap of up to three
+//'   characters,
+//' * a backslash, which escapes the following character.
+//'
+//' @inheritParams fm_index_locate
+//' @param patterns Patterns to search for. For case-insensitive indices,
+//'   letters in patterns must be lowercase.
+//' @return A data frame like for [fm_index_locate()], with an additional
+//'   column `length`, the length of the match. If matches of different
+//'   length start at the same position, only the shortest is reported. Hits
+//'   are sorted by `corpus_index` and `position` within each pattern.
+//'
+//' @examples
+//' data("state")
+//' index <- fm_index_create(state.name, case_sensitive = FALSE)
+//' hits <- fm_index_locate_pattern("[nm]?{0,2}a", index)
+//' state.name[hits$corpus_index]
+//'
 //' @family FM Index functions
 //' @export
 // [[Rcpp::export]]
-DataFrame fm_index_locate(const CharacterVector& patterns, const List& index) {
-  return unwrap_index(index)->locate(patterns);
+DataFrame fm_index_locate_pattern(const CharacterVector& patterns, const List& index, int n_threads = 1) {
+  return unwrap_index(index)->locate_pattern(patterns, n_threads);
+}
+
+//' Count occurrences of given patterns
+//'
+//' Counts how often each of the given patterns occurs in the FM Index. This is
+//' much faster than [fm_index_locate()] because occurrences only need to be
+//' counted, not located in the corpus.
+//'
+//' @inheritParams fm_index_locate
+//' @return An integer vector with the number of occurrences of each pattern
+//'   in the corpus, in the same order as `patterns`. A double vector is
+//'   returned if any count exceeds the range of R integers.
+//'
+//' @examples
+//' data("state")
+//' index <- fm_index_create(state.name, case_sensitive = FALSE)
+//' fm_index_count(c("new", "ar", "xyz"), index)
+//' fm_index_count(c("new", "ar", "xyz"), index, anchor = "start")
+//'
+//' @family FM Index functions
+//' @export
+// [[Rcpp::export]]
+RObject fm_index_count(
+  const CharacterVector& patterns, const List& index, int n_threads = 1,
+  CharacterVector anchor = CharacterVector::create("none", "start", "end", "full")
+) {
+  return unwrap_index(index)->count(patterns, parse_anchor(anchor), n_threads);
+}
+
+//' List corpus strings containing given patterns
+//'
+//' Finds all strings in the corpus that contain each of the given patterns,
+//' without locating every single occurrence. If the index was created with
+//' `document_listing = TRUE`, the time needed only depends on the number of
+//' distinct matching strings, not on the number of occurrences.
+//'
+//' @inheritParams fm_index_locate
+//' @param counts If TRUE, also count the occurrences of each pattern in each
+//'   string. This requires locating every occurrence.
+//' @return A data frame with one row per pattern and matching corpus string,
+//'   sorted by `corpus_index` within each pattern. `pattern_index` is the
+//'   index of the query pattern and `corpus_index` is the index of the
+//'   matching string in the corpus. With `counts = TRUE` an additional
+//'   column `n` holds the number of occurrences. All indices are 1-based.
+//'
+//' @examples
+//' data("state")
+//' index <- fm_index_create(
+//'   state.name, case_sensitive = FALSE, document_listing = TRUE
+//' )
+//' docs <- fm_index_documents(c("new", "a"), index)
+//' state.name[docs$corpus_index[docs$pattern_index == 1]]
+//'
+//' fm_index_documents("a", index, counts = TRUE)
+//'
+//' @family FM Index functions
+//' @export
+// [[Rcpp::export]]
+DataFrame fm_index_documents(const CharacterVector& patterns, const List& index, bool counts = false, int n_threads = 1) {
+  return unwrap_index(index)->documents(patterns, counts, n_threads);
+}
+
+//' Extract substrings of corpus strings from an FM Index
+//'
+//' Decodes text directly from the index, so that the corpus does not need to
+//' be kept in memory alongside it. Extracting a substring takes one lookup in
+//' the sampled inverse suffix array and one step per character. Arguments
+//' are recycled to the length of the longest one, like in
+//' [stringi::stri_sub()].
+//'
+//' @inheritParams fm_index_locate
+//' @param corpus_index Indices of the corpus strings, 1-based
+//' @param start,end Positions of the first and last character of the
+//'   substrings, 1-based and inclusive. Negative positions count from the end
+//'   of the string, `-1` being its last character. Positions are clamped to
+//'   the string.
+//' @param n_threads Number of threads used for decoding
+//' @return A character vector with the substrings. Strings of
+//'   case-insensitive indices are lowercase. Deleted strings give `NA`, as do
+//'   `NA` arguments.
+//'
+//' @examples
+//' data("state")
+//' index <- fm_index_create(state.name)
+//' hits <- fm_index_locate("ew", index)
+//' fm_index_extract(index, hits$corpus_index, hits$position - 1, hits$position + 4)
+//'
+//' @family FM Index functions
+//' @export
+// [[Rcpp::export]]
+CharacterVector fm_index_extract(
+  const List& index, const NumericVector& corpus_index,
+  const IntegerVector& start = IntegerVector::create(1),
+  const IntegerVector& end = IntegerVector::create(-1), int n_threads = 1
+) {
+  auto* fm_index = unwrap_index(index);
+  const auto n_documents = fm_index->n_documents();
+  R_xlen_t n = 0;
+  if (corpus_index.size() > 0 && start.size() > 0 && end.size() > 0)
+    n = std::max(corpus_index.size(), std::max(start.size(), end.size()));
+  std::vector<FMIndex::size_type> documents(n);
+  std::vector<std::int64_t> starts(n), ends(n);
+  for (R_xlen_t i = 0; i < n; i++) {
+    const auto x = corpus_index[i % corpus_index.size()];
+    starts[i] = start[i % start.size()];
+    ends[i] = end[i % end.size()];
+    if (NumericVector::is_na(x) || starts[i] == NA_INTEGER || ends[i] == NA_INTEGER) {
+      documents[i] = FMIndex::missing_document;
+      continue;
+    }
+    if (!(x >= 1 && x <= n_documents))
+      stop("Corpus indices must be between 1 and the number of corpus strings");
+    documents[i] = static_cast<FMIndex::size_type>(x) - 1;
+  }
+  return fm_index->extract(documents, starts, ends, n_threads);
+}
+
+//' Extract whole corpus strings from an FM Index
+//'
+//' Decodes whole corpus strings from the index, like [fm_index_extract()]
+//' with default positions. With the default `corpus_index`, this restores the
+//' corpus the index was created from.
+//'
+//' @inheritParams fm_index_extract
+//' @param corpus_index Indices of the corpus strings, 1-based. All strings
+//'   if `NULL`.
+//' @return A character vector with the corpus strings. Strings of
+//'   case-insensitive indices are lowercase. Deleted strings give `NA`.
+//'
+//' @examples
+//' data("state")
+//' index <- fm_index_create(state.name, case_sensitive = TRUE)
+//' identical(fm_index_extract_strings(index), state.name)
+//'
+//' @family FM Index functions
+//' @export
+// [[Rcpp::export]]
+CharacterVector fm_index_extract_strings(
+  const List& index, Nullable<NumericVector> corpus_index = R_NilValue, int n_threads = 1
+) {
+  auto* fm_index = unwrap_index(index);
+  const auto n_documents = fm_index->n_documents();
+  std::vector<FMIndex::size_type> documents;
+  if (corpus_index.isNull()) {
+    documents.resize(n_documents);
+    std::iota(documents.begin(), documents.end(), 0);
+  } else {
+    for (const auto& x: as<NumericVector>(corpus_index)) {
+      if (NumericVector::is_na(x)) {
+        documents.push_back(FMIndex::missing_document);
+        continue;
+      }
+      if (!(x >= 1 && x <= n_documents))
+        stop("Corpus indices must be between 1 and the number of corpus strings");
+      documents.push_back(static_cast<FMIndex::size_type>(x) - 1);
+    }
+  }
+  return fm_index->extract(
+    documents, std::vector<std::int64_t>(documents.size(), 1),
+    std::vector<std::int64_t>(documents.size(), -1), n_threads
+  );
 }
 
 //' Save / load FM indices
@@ -184,6 +2761,11 @@ DataFrame fm_index_locate(const CharacterVector& patterns, const List& index) {
 //'
 //' @param index FM Index to be saved to disk
 //' @param path Path where to save index to or load index from
+//' @param mmap If `TRUE`, map the index file into memory instead of reading
+//'   it. Loading then takes almost no time and memory, the operating system
+//'   reads parts of the index on demand and shares them between all R
+//'   processes using the same file. The file must not be modified or deleted
+//'   while the index is in use.
 //'
 //' @return
 //' For `fm_index_load`, a FM Index object that can be passed to [fm_index_locate()] for
@@ -215,8 +2797,6 @@ void fm_index_save(const List& index, const String& path) {
 //' @describeIn fm_index_save Load FM Index from disk
 //' @export
 // [[Rcpp::export]]
-List fm_index_load(const String& path) {
-  auto* fm_index = new FMIndex();
-  fm_index->load_file(path);
-  return wrap_index(fm_index);
+List fm_index_load(const String& path, bool mmap = false) {
+  return wrap_index(FMIndex::load_file(path, mmap));
 }
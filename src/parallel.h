@@ -0,0 +1,52 @@
+#ifndef FM_INDEX_PARALLEL_H
+#define FM_INDEX_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Calls f(i) for every task i in [0, n_tasks) using up to n_threads threads.
+// Tasks are handed out one at a time from a shared counter, so threads that
+// finish cheap tasks keep pulling work instead of idling while others are
+// stuck on expensive ones. The calling thread takes part in the work.
+//
+// f must not touch the R API or any R object, it runs outside the main thread.
+// The first exception thrown by f stops all workers and is rethrown here.
+template<class F>
+void parallel_for(size_t n_tasks, int n_threads, F f) {
+  const size_t n_workers = std::min<size_t>(std::max(n_threads, 1), n_tasks);
+  if (n_workers <= 1) {
+    for (size_t i = 0; i < n_tasks; i++)
+      f(i);
+    return;
+  }
+  std::atomic<size_t> next_task(0);
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  auto worker = [&]() {
+    try {
+      for (size_t i = next_task++; i < n_tasks; i = next_task++)
+        f(i);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (!error)
+        error = std::current_exception();
+      next_task = n_tasks;
+    }
+  };
+  std::vector<std::thread> threads;
+  threads.reserve(n_workers - 1);
+  for (size_t i = 1; i < n_workers; i++)
+    threads.emplace_back(worker);
+  worker();
+  for (auto& thread: threads)
+    thread.join();
+  if (error)
+    std::rethrow_exception(error);
+}
+
+#endif
@@ -0,0 +1,200 @@
+#ifndef FM_INDEX_PATTERN_H
+#define FM_INDEX_PATTERN_H
+
+#include <bitset>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sdsl/suffix_array_algorithm.hpp>
+
+#include "approximate.h"
+
+// One element of a search pattern: a set of characters repeated between
+// min and max times
+struct PatternElement {
+  std::bitset<256> symbols;
+  std::uint32_t min = 1;
+  std::uint32_t max = 1;
+};
+
+// Upper bound of repetitions, to keep the search bounded
+const std::uint32_t max_pattern_repetitions = 1000;
+
+// Parses the pattern language of fm_index_locate_pattern(). Characters match
+// themselves, ? matches any character, [...] matches a character class with
+// ranges like a-z and negation by a leading ^, and \ escapes the next
+// character. Every element may be followed by {n} or {min,max} to repeat it.
+// The separator never matches.
+inline std::vector<PatternElement> parse_pattern(const std::string& pattern, char separator) {
+  std::vector<PatternElement> elements;
+  auto error = [&](const std::string& message) {
+    return std::invalid_argument("Invalid pattern \"" + pattern + "\": " + message);
+  };
+  size_t i = 0;
+  auto next = [&]() -> unsigned char {
+    if (i == pattern.size())
+      throw error("unexpected end");
+    return pattern[i++];
+  };
+  auto number = [&]() {
+    const auto begin = i;
+    std::uint32_t x = 0;
+    while (i < pattern.size() && pattern[i] >= '0' && pattern[i] <= '9') {
+      x = x * 10 + (pattern[i++] - '0');
+      if (x > max_pattern_repetitions)
+        throw error("at most " + std::to_string(max_pattern_repetitions) + " repetitions are allowed");
+    }
+    if (i == begin)
+      throw error("expected a number of repetitions");
+    return x;
+  };
+  while (i < pattern.size()) {
+    PatternElement element;
+    auto c = next();
+    if (c == '?') {
+      element.symbols.set();
+    } else if (c == '[') {
+      const bool negated = i < pattern.size() && pattern[i] == '^';
+      if (negated)
+        i++;
+      // A ] right at the start belongs to the class
+      bool first = true;
+      while ((c = next()) != ']' || first) {
+        first = false;
+        if (c == '\\')
+          c = next();
+        unsigned char last = c;
+        if (i + 1 < pattern.size() && pattern[i] == '-' && pattern[i + 1] != ']') {
+          i++;
+          last = next();
+          if (last == '\\')
+            last = next();
+          if (last < c)
+            throw error("invalid range in character class");
+        }
+        for (unsigned x = c; x <= last; x++)
+          element.symbols.set(x);
+      }
+      if (negated)
+        element.symbols.flip();
+    } else {
+      if (c == '\\')
+        c = next();
+      else if (c == ']' || c == '{' || c == '}')
+        throw error(std::string("unescaped ") + static_cast<char>(c));
+      element.symbols.set(c);
+    }
+    if (i < pattern.size() && pattern[i] == '{') {
+      i++;
+      element.min = element.max = number();
+      if (next() == ',') {
+        element.max = number();
+        if (next() != '}')
+          throw error("expected }");
+      } else if (pattern[i - 1] != '}') {
+        throw error("expected }");
+      }
+      if (element.max < element.min)
+        throw error("maximum repetitions below minimum");
+    }
+    element.symbols.reset(0);
+    element.symbols.reset(static_cast<unsigned char>(separator));
+    if (element.symbols.none() && element.min > 0)
+      throw error("character class matches no character");
+    if (element.max > 0)
+      elements.push_back(element);
+  }
+  return elements;
+}
+
+// Finds all substrings of the text of a csa_wt matching a parsed pattern by
+// branching backward search from the end of the pattern. At every suffix
+// array range, interval_symbols lists all symbols preceding the range and
+// their ranks in a single traversal of the wavelet tree, and the symbols of
+// the current element are followed. Literal characters take a single
+// backward search step.
+template<class csa_t>
+class PatternSearch {
+public:
+  using size_type = typename csa_t::size_type;
+  PatternSearch(const csa_t& index, const std::vector<PatternElement>& elements) :
+    index(index), elements(elements)
+  {
+    size_type max_length = 0;
+    for (const auto& element: elements)
+      max_length += element.max;
+    for (const auto& element: elements) {
+      int literal = -1;
+      if (element.min == 1 && element.max == 1 && element.symbols.count() == 1) {
+        for (literal = 0; !element.symbols[literal]; literal++) {}
+      }
+      literals.push_back(literal);
+    }
+    const auto sigma = index.wavelet_tree.sigma;
+    branches.resize(max_length);
+    for (auto& x: branches) {
+      x.symbols.resize(sigma);
+      x.rank_begin.resize(sigma);
+      x.rank_end.resize(sigma);
+    }
+  };
+  // Appends the ranges of all non-empty matches to ranges, with distance 0.
+  // The same substring may be found more than once if elements overlap.
+  void run(std::vector<ApproximateRange>& ranges_) {
+    ranges = &ranges_;
+    search(elements.size(), 0, 0, 0, index.size());
+  };
+private:
+  const csa_t& index;
+  const std::vector<PatternElement>& elements;
+  std::vector<ApproximateRange>* ranges = nullptr;
+  // The character of elements matching a single character exactly once,
+  // -1 for all others
+  std::vector<int> literals;
+  struct Branches {
+    size_type k;
+    std::vector<typename csa_t::wavelet_tree_type::value_type> symbols;
+    std::vector<size_type> rank_begin, rank_end;
+  };
+  // One buffer per length of the match so far
+  std::vector<Branches> branches;
+  // The elements before element are left to match, repetitions of it are
+  // matched already, and the substring of [begin, end) is length long
+  void search(size_type element, size_type repetitions, size_type length, size_type begin, size_type end);
+};
+
+template<class csa_t>
+void PatternSearch<csa_t>::search(
+  size_type element, size_type repetitions, size_type length, size_type begin, size_type end
+) {
+  if (element == 0) {
+    if (length > 0)
+      ranges->push_back({begin, end - begin, length, 0});
+    return;
+  }
+  const auto& e = elements[element - 1];
+  if (repetitions >= e.min)
+    search(element - 1, 0, length, begin, end);
+  if (repetitions == e.max)
+    return;
+  if (literals[element - 1] >= 0) {
+    size_type l, r;
+    const unsigned char c = literals[element - 1];
+    if (sdsl::backward_search(index, begin, end - 1, c, l, r) > 0)
+      search(element, repetitions + 1, length + 1, l, r + 1);
+    return;
+  }
+  auto& x = branches[length];
+  index.wavelet_tree.interval_symbols(begin, end, x.k, x.symbols, x.rank_begin, x.rank_end);
+  for (size_type i = 0; i < x.k; i++) {
+    const auto c = x.symbols[i];
+    if (!e.symbols[c])
+      continue;
+    const auto c_begin = index.C[index.char2comp[c]];
+    search(element, repetitions + 1, length + 1, c_begin + x.rank_begin[i], c_begin + x.rank_end[i]);
+  }
+}
+
+#endif
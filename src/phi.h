@@ -0,0 +1,79 @@
+#ifndef FM_INDEX_PHI_H
+#define FM_INDEX_PHI_H
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include <sdsl/int_vector.hpp>
+#include <sdsl/sd_vector.hpp>
+
+// The function phi maps the suffix array value of a row to that of the
+// preceding row. Within a run of equal characters of the BWT, neighbouring
+// rows stay neighbours after an LF step, so phi(x) = phi(x - 1) + 1 unless
+// the row of x starts a run. Sampling phi at the text positions of rows
+// starting a run therefore determines it everywhere: phi(x) = phi(p) + x - p
+// with p the closest sampled position not after x. The sampled positions are
+// stored as an Elias-Fano coded bit vector, their values in text order.
+class PhiSamples {
+public:
+  using size_type = sdsl::sd_vector<>::size_type;
+  PhiSamples() { init_support(); };
+  // Samples given as pairs of text position and value, in any order
+  PhiSamples(std::vector< std::pair<size_type, size_type> >& samples, size_type text_size);
+  PhiSamples(const PhiSamples& other) : positions(other.positions), values(other.values) {
+    init_support();
+  };
+  PhiSamples& operator=(const PhiSamples& other);
+  // Suffix array value of the row preceding the row of text position x.
+  // Undefined for the position of the first row.
+  size_type operator()(size_type x) const {
+    const auto k = positions_rank(x + 1);
+    return values[k - 1] + x - positions_select(k);
+  };
+  template<class Archive>
+  void save(Archive& archive) const {
+    archive(positions, values);
+  };
+  template<class Archive>
+  void load(Archive& archive) {
+    archive(positions, values);
+    init_support();
+  };
+private:
+  void init_support();
+  sdsl::sd_vector<> positions;
+  sdsl::sd_vector<>::rank_1_type positions_rank;
+  sdsl::sd_vector<>::select_1_type positions_select;
+  sdsl::int_vector<> values;
+};
+
+inline PhiSamples::PhiSamples(
+  std::vector< std::pair<size_type, size_type> >& samples, size_type text_size
+) {
+  std::sort(samples.begin(), samples.end());
+  sdsl::sd_vector_builder builder(text_size, samples.size());
+  values = sdsl::int_vector<>(samples.size(), 0, sdsl::bits::hi(text_size) + 1);
+  for (size_type i = 0; i < samples.size(); i++) {
+    builder.set(samples[i].first);
+    values[i] = samples[i].second;
+  }
+  positions = sdsl::sd_vector<>(builder);
+  init_support();
+}
+
+inline PhiSamples& PhiSamples::operator=(const PhiSamples& other) {
+  if (this != &other) {
+    positions = other.positions;
+    values = other.values;
+    init_support();
+  }
+  return *this;
+}
+
+inline void PhiSamples::init_support() {
+  sdsl::util::init_support(positions_rank, &positions);
+  sdsl::util::init_support(positions_select, &positions);
+}
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef FM_INDEX_QGRAMS_H
+#define FM_INDEX_QGRAMS_H
+
+#include <cstdint>
+#include <string>
+
+#include <sdsl/int_vector.hpp>
+
+// Suffix array ranges of all strings of up to q characters (q-grams), which
+// replace the first q steps of backward search by two table lookups. Every
+// suffix array row is keyed by the first q characters of its suffix, written
+// as digits of their rank in the alphabet of the index and padded with the
+// sentinel, which has rank 0. Keys never decrease along the suffix array, so
+// with begins[key] the number of rows with a smaller key, the rows starting
+// with any string of up to q characters lie between two entries.
+class QGramTable {
+public:
+  using size_type = std::uint64_t;
+  QGramTable() {};
+  // Table for q-grams of the text of index, with q lowered until the table
+  // has at most one entry per max_text_per_entry characters of the text.
+  // q is 0 if not even single characters fit.
+  template<class csa_t>
+  QGramTable(const csa_t& index, size_type q);
+  static const size_type max_text_per_entry = 16;
+  // Length of the q-grams in the table, 0 if there is no table
+  size_type q() const { return q_; };
+  // q requested when building the table
+  size_type requested_q() const { return requested_q_; };
+  // Rows of suffixes starting with text, at most q characters long. Returns
+  // their number, range_end is inclusive.
+  template<class csa_t>
+  size_type find(
+    const csa_t& index, const std::string& text, size_type& range_begin,
+    size_type& range_end
+  ) const;
+  template<class Archive>
+  void save(Archive& archive) const {
+    archive(begins, q_, requested_q_, sigma);
+  };
+  template<class Archive>
+  void load(Archive& archive) {
+    archive(begins, q_, requested_q_, sigma);
+  };
+private:
+  sdsl::int_vector<> begins;
+  size_type q_ = 0;
+  size_type requested_q_ = 0;
+  // Number of distinct characters in the text including the sentinel, the
+  // base of keys
+  size_type sigma = 0;
+};
+
+// Counts the keys of all text positions while walking the text backwards
+// from the sentinel using LF, then sums up the counts
+template<class csa_t>
+QGramTable::QGramTable(const csa_t& index, size_type q) :
+  requested_q_(q), sigma(index.sigma)
+{
+  const auto n = index.size();
+  size_type n_keys = 1;
+  while (q_ < q && n_keys * sigma <= n / max_text_per_entry) {
+    n_keys *= sigma;
+    q_++;
+  }
+  if (q_ == 0)
+    return;
+  begins = sdsl::int_vector<>(n_keys + 1, 0, sdsl::bits::hi(n) + 1);
+  const auto top = n_keys / sigma;
+  // The key of the suffix consisting only of the sentinel is 0
+  size_type key = 0, row = 0;
+  begins[key]++;
+  for (size_type i = 1; i < n; i++) {
+    const auto x = index.wavelet_tree.inverse_select(row);
+    const auto comp = index.char2comp[x.second];
+    key = comp * top + key / sigma;
+    begins[key]++;
+    row = index.C[comp] + x.first;
+  }
+  size_type sum = 0;
+  for (size_type i = 0; i <= n_keys; i++) {
+    const size_type count = begins[i];
+    begins[i] = sum;
+    sum += count;
+  }
+}
+
+template<class csa_t>
+QGramTable::size_type QGramTable::find(
+  const csa_t& index, const std::string& text, size_type& range_begin,
+  size_type& range_end
+) const {
+  size_type key = 0, span = 1;
+  for (size_type i = 0; i < q_; i++) {
+    if (i < text.size()) {
+      const auto comp = index.char2comp[static_cast<unsigned char>(text[i])];
+      // Only the sentinel has rank 0, all other characters of rank 0 do not
+      // occur in the text
+      if (comp == 0)
+        return 0;
+      key = key * sigma + comp;
+    } else {
+      key *= sigma;
+      span *= sigma;
+    }
+  }
+  range_begin = begins[key];
+  const size_type end = begins[key + span];
+  range_end = end - 1;
+  return end - range_begin;
+}
+
+#endif
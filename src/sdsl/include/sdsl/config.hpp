@@ -59,7 +59,8 @@ enum format_type
 enum byte_sa_algo_type
 {
     LIBDIVSUFSORT,
-    SE_SAIS
+    SE_SAIS,
+    PARALLEL_LIBDIVSUFSORT
 };
 
 //! Helper class for construction process
@@ -4,6 +4,9 @@
 #ifndef INCLUDED_SDSL_CONSTRUCT_CONFIG
 #define INCLUDED_SDSL_CONSTRUCT_CONFIG
 
+#include <algorithm>
+#include <thread>
+
 #include <sdsl/config.hpp>
 
 namespace sdsl
@@ -12,14 +15,26 @@ namespace sdsl
 struct construct_config_data
 {
     byte_sa_algo_type byte_algo_sa = LIBDIVSUFSORT;
+    //! Number of threads used by PARALLEL_LIBDIVSUFSORT and wavelet tree construction,
+    //! 0 for one per hardware thread
+    uint32_t n_threads = 1;
 };
 
+//! Construction settings, separate for every thread so that concurrent constructions can use different settings.
 extern inline construct_config_data & construct_config()
 {
-    static construct_config_data data;
+    static thread_local construct_config_data data;
     return data;
 }
 
+//! Number of threads to use for parallel construction steps.
+inline uint32_t construct_threads()
+{
+    uint32_t n_threads = construct_config().n_threads;
+    if (n_threads == 0) { n_threads = std::max(std::thread::hardware_concurrency(), 1u); }
+    return n_threads;
+}
+
 } // namespace sdsl
 
 #endif
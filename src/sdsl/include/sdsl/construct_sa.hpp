@@ -78,7 +78,7 @@ namespace algorithm
  */
 
 template <typename t_int_vec>
-void calculate_sa(const unsigned char * c, typename t_int_vec::size_type len, t_int_vec & sa)
+void calculate_sa(const unsigned char * c, typename t_int_vec::size_type len, t_int_vec & sa, uint32_t n_threads = 1)
 {
     typedef typename t_int_vec::size_type size_type;
     constexpr uint8_t t_width = t_int_vec::fixed_int_width;
@@ -97,7 +97,7 @@ void calculate_sa(const unsigned char * c, typename t_int_vec::size_type len, t_
         {
             sa.width(32);
             sa.resize(len);
-            divsufsort(c, (int32_t *)sa.data(), (int32_t)len);
+            divsufsort(c, (int32_t *)sa.data(), (int32_t)len, n_threads);
             // copy integers back to the right positions
             if (sa_width != 32)
             {
@@ -116,7 +116,7 @@ void calculate_sa(const unsigned char * c, typename t_int_vec::size_type len, t_
                 throw std::logic_error("width of int_vector is to small for the text!!!");
             }
             int_vector<> sufarray(len, 0, 32);
-            divsufsort(c, (int32_t *)sufarray.data(), (int32_t)len);
+            divsufsort(c, (int32_t *)sufarray.data(), (int32_t)len, n_threads);
             sa.resize(len);
             for (size_type i = 0; i < len; ++i) { sa[i] = sufarray[i]; }
         }
@@ -126,7 +126,7 @@ void calculate_sa(const unsigned char * c, typename t_int_vec::size_type len, t_
         uint8_t sa_width = sa.width();
         sa.width(64);
         sa.resize(len);
-        divsufsort64(c, (int64_t *)sa.data(), len);
+        divsufsort64(c, (int64_t *)sa.data(), len, n_threads);
         // copy integers back to the right positions
         if (sa_width != 64)
         {
@@ -156,6 +156,8 @@ void calculate_sa(const unsigned char * c, typename t_int_vec::size_type len, t_
  *         * conf::KEY_SA
  *  \par Reference
  *    For t_width=8: DivSufSort (http://code.google.com/p/libdivsufsort/)
+ *    With PARALLEL_LIBDIVSUFSORT, DivSufSort sorts the type B* substrings on
+ *    construct_config().n_threads threads, using no additional memory.
  *    For t_width=0: qsufsort (http://www.larsson.dogma.net/qsufsort.c)
  */
 template <uint8_t t_width>
@@ -166,12 +168,15 @@ void construct_sa(cache_config & config)
     const char * KEY_TEXT = key_text_trait<t_width>::KEY_TEXT;
     if (t_width == 8)
     {
-        if (construct_config().byte_algo_sa == LIBDIVSUFSORT)
+        if (construct_config().byte_algo_sa == LIBDIVSUFSORT or
+            construct_config().byte_algo_sa == PARALLEL_LIBDIVSUFSORT)
         {
+            uint32_t n_threads = 1;
+            if (construct_config().byte_algo_sa == PARALLEL_LIBDIVSUFSORT) { n_threads = construct_threads(); }
             read_only_mapper<t_width> text(KEY_TEXT, config);
             auto sa = write_out_mapper<0>::create(cache_file_name(conf::KEY_SA, config), 0, bits::hi(text.size()) + 1);
             // call divsufsort
-            algorithm::calculate_sa((const unsigned char *)text.data(), text.size(), sa);
+            algorithm::calculate_sa((const unsigned char *)text.data(), text.size(), sa, n_threads);
         }
         else if (construct_config().byte_algo_sa == SE_SAIS)
         {
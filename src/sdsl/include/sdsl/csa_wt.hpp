@@ -16,6 +16,7 @@
 #include <iterator>
 
 #include <sdsl/csa_alphabet_strategy.hpp>
+#include <sdsl/construct_config.hpp>
 #include <sdsl/csa_sampling_strategy.hpp>
 #include <sdsl/fast_cache.hpp>
 #include <sdsl/iterators.hpp>
@@ -320,9 +321,18 @@ csa_wt<t_wt, t_dens, t_inv_dens, t_sa_sample_strat, t_isa, t_alphabet_strat>::cs
     // }
     {
         auto event = memory_monitor::event("construct wavelet tree");
-        int_vector_buffer<alphabet_type::int_width> bwt_buf(
-                                                          cache_file_name(key_bwt<alphabet_type::int_width>(), config));
-        m_wavelet_tree = wavelet_tree_type(bwt_buf.begin(), bwt_buf.end(), config.dir);
+        if (construct_threads() > 1)
+        { // several threads can only read the BWT in memory
+            int_vector<alphabet_type::int_width> bwt;
+            load_from_cache(bwt, key_bwt<alphabet_type::int_width>(), config);
+            m_wavelet_tree = wavelet_tree_type(bwt.begin(), bwt.end(), config.dir);
+        }
+        else
+        {
+            int_vector_buffer<alphabet_type::int_width> bwt_buf(
+                                                              cache_file_name(key_bwt<alphabet_type::int_width>(), config));
+            m_wavelet_tree = wavelet_tree_type(bwt_buf.begin(), bwt_buf.end(), config.dir);
+        }
     }
 }
 
@@ -30,11 +30,10 @@
 #include <algorithm>
 #include <assert.h>
 #include <inttypes.h>
+#include <mutex>
 #include <stdio.h>
-
-#ifdef _OPENMP
-#include <omp.h>
-#endif
+#include <thread>
+#include <vector>
 
 namespace sdsl
 {
@@ -1794,21 +1793,65 @@ inline void trsort(saidx_t * ISA, saidx_t * SA, saidx_t n, saidx_t depth)
     }
 }
 
+/* Sorts the type B* substrings of all buckets using sssort on n_threads threads.
+   Buckets are handed out one at a time, starting with the largest characters.
+   Every thread uses its own part of the free space in SA as buffer, so no
+   memory beyond that of the sequential algorithm is needed. */
+template <typename saidx_t>
+inline void sssort_parallel(const uint8_t * T,
+                            const saidx_t * PAb,
+                            saidx_t * SA,
+                            const saidx_t * bucket_B,
+                            saidx_t * buf,
+                            saidx_t bufsize,
+                            saidx_t n,
+                            saidx_t m,
+                            uint32_t n_threads)
+{
+    std::mutex bucket_mutex;
+    int32_t c0 = ALPHABET_SIZE - 2, c1 = ALPHABET_SIZE - 1;
+    saidx_t j = m;
+    bufsize /= n_threads;
+    auto worker = [&](uint32_t thread) {
+        saidx_t * curbuf = buf + thread * bufsize;
+        saidx_t k = 0, l;
+        int32_t d0, d1;
+        for (;;)
+        {
+            {
+                std::lock_guard<std::mutex> lock(bucket_mutex);
+                if (0 < (l = j))
+                {
+                    d0 = c0, d1 = c1;
+                    do {
+                        k = BUCKET_BSTAR(d0, d1);
+                        if (--d1 <= d0)
+                        {
+                            d1 = ALPHABET_SIZE - 1;
+                            if (--d0 < 0) { break; }
+                        }
+                    } while (((l - k) <= 1) && (0 < (l = k)));
+                    c0 = d0, c1 = d1, j = k;
+                }
+            }
+            if (l == 0) { break; }
+            sssort(T, PAb, SA + k, SA + l, curbuf, bufsize, (saidx_t)2, n, *(SA + k) == (m - 1));
+        }
+    };
+    std::vector<std::thread> threads;
+    for (uint32_t thread = 1; thread < n_threads; ++thread) { threads.emplace_back(worker, thread); }
+    worker(0);
+    for (auto & thread : threads) { thread.join(); }
+}
+
 /* Sorts suffixes of type B*. */
 template <typename saidx_t>
-inline saidx_t sort_typeBstar(const uint8_t * T, saidx_t * SA, saidx_t * bucket_A, saidx_t * bucket_B, saidx_t n)
+inline saidx_t
+sort_typeBstar(const uint8_t * T, saidx_t * SA, saidx_t * bucket_A, saidx_t * bucket_B, saidx_t n, uint32_t n_threads)
 {
     saidx_t *PAb, *ISAb, *buf;
-#ifdef _OPENMP
-    saidx_t * curbuf;
-    saidx_t l;
-#endif
     saidx_t i, j, k, t, m, bufsize;
     int32_t c0, c1;
-#ifdef _OPENMP
-    int32_t d0, d1;
-    int tmp;
-#endif
 
     /* Initialize bucket arrays. */
     for (i = 0; i < BUCKET_A_SIZE; ++i) { bucket_A[i] = 0; }
@@ -1867,48 +1910,22 @@ inline saidx_t sort_typeBstar(const uint8_t * T, saidx_t * SA, saidx_t * bucket_
         SA[--BUCKET_BSTAR(c0, c1)] = m - 1;
 
         /* Sort the type B* substrings using sssort. */
-#ifdef _OPENMP
-        tmp = omp_get_max_threads();
-        buf = SA + m, bufsize = (n - (2 * m)) / tmp;
-        c0 = ALPHABET_SIZE - 2, c1 = ALPHABET_SIZE - 1, j = m;
-#pragma omp parallel default(shared) private(curbuf, k, l, d0, d1, tmp)
-        {
-            tmp = omp_get_thread_num();
-            curbuf = buf + tmp * bufsize;
-            k = 0;
-            for (;;)
+        buf = SA + m, bufsize = n - (2 * m);
+        if (n_threads > 1) { sssort_parallel(T, PAb, SA, bucket_B, buf, bufsize, n, m, n_threads); }
+        else
+        {
+            for (c0 = ALPHABET_SIZE - 2, j = m; 0 < j; --c0)
             {
-#pragma omp critical(sssort_lock)
+                for (c1 = ALPHABET_SIZE - 1; c0 < c1; j = i, --c1)
                 {
-                    if (0 < (l = j))
+                    i = BUCKET_BSTAR(c0, c1);
+                    if (1 < (j - i))
                     {
-                        d0 = c0, d1 = c1;
-                        do {
-                            k = BUCKET_BSTAR(d0, d1);
-                            if (--d1 <= d0)
-                            {
-                                d1 = ALPHABET_SIZE - 1;
-                                if (--d0 < 0) { break; }
-                            }
-                        } while (((l - k) <= 1) && (0 < (l = k)));
-                        c0 = d0, c1 = d1, j = k;
+                        sssort(T, PAb, SA + i, SA + j, buf, bufsize, (saidx_t)2, n, *(SA + i) == (m - 1));
                     }
                 }
-                if (l == 0) { break; }
-                sssort(T, PAb, SA + k, SA + l, curbuf, bufsize, (saidx_t)2, n, *(SA + k) == (m - 1));
             }
         }
-#else
-        buf = SA + m, bufsize = n - (2 * m);
-        for (c0 = ALPHABET_SIZE - 2, j = m; 0 < j; --c0)
-        {
-            for (c1 = ALPHABET_SIZE - 1; c0 < c1; j = i, --c1)
-            {
-                i = BUCKET_BSTAR(c0, c1);
-                if (1 < (j - i)) { sssort(T, PAb, SA + i, SA + j, buf, bufsize, (saidx_t)2, n, *(SA + i) == (m - 1)); }
-            }
-        }
-#endif
 
         /* Compute ranks of type B* substrings. */
         for (i = m - 1; 0 <= i; --i)
@@ -2124,8 +2141,9 @@ inline saidx_t construct_BWT(const uint8_t * T,
 
 /*- Function -*/
 
+/* Sorting of type B* substrings, the most expensive step, runs on n_threads threads. */
 template <typename saidx_t>
-int32_t divsufsort(const uint8_t * T, saidx_t * SA, saidx_t n)
+int32_t divsufsort(const uint8_t * T, saidx_t * SA, saidx_t n, uint32_t n_threads = 1)
 {
     saidx_t *bucket_A, *bucket_B;
     saidx_t m;
@@ -2155,7 +2173,7 @@ int32_t divsufsort(const uint8_t * T, saidx_t * SA, saidx_t n)
     /* Suffixsort. */
     if ((bucket_A != NULL) && (bucket_B != NULL))
     {
-        m = sort_typeBstar(T, SA, bucket_A, bucket_B, n);
+        m = sort_typeBstar(T, SA, bucket_A, bucket_B, n, n_threads);
         construct_SA(T, SA, bucket_A, bucket_B, n, m);
     }
     else
@@ -2205,9 +2223,9 @@ int32_t divsufsort(const uint8_t * T, saidx_t * SA, saidx_t n)
 //   return pidx;
 // }
 
-inline int32_t divsufsort64(const uint8_t * T, int64_t * SA, int64_t n)
+inline int32_t divsufsort64(const uint8_t * T, int64_t * SA, int64_t n, uint32_t n_threads = 1)
 {
-    return divsufsort(T, SA, n);
+    return divsufsort(T, SA, n, n_threads);
 }
 
 template <typename saidx_t>
@@ -672,6 +672,22 @@ class int_vector
                                    void>::type
     CEREAL_LOAD_FUNCTION_NAME(archive_t & ar);
 
+  private:
+    //! Uses archive_t::borrow_binary if the archive provides it.
+    template <typename archive_t>
+    static auto borrow_binary(archive_t & ar, size_t size_in_bytes, int)
+                                                      -> decltype(ar.borrow_binary(size_in_bytes))
+    {
+        return ar.borrow_binary(size_in_bytes);
+    }
+
+    template <typename archive_t>
+    static const void * borrow_binary(archive_t &, size_t, long)
+    {
+        return nullptr;
+    }
+
+  public:
     //! non const version of [] operator
     /*!\param i Index the i-th integer of length width().
      *  \return A reference to the i-th integer of length width().
@@ -1886,6 +1902,16 @@ int_vector<t_width>::CEREAL_LOAD_FUNCTION_NAME(archive_t & ar)
     ar(CEREAL_NVP(cereal::make_size_tag(m_width)));
     ar(CEREAL_NVP(growth_factor));
     ar(CEREAL_NVP(cereal::make_size_tag(m_size)));
+    // Archives reading from memory that outlives the vector, e.g. a file mapping, can hand out the
+    // data in place instead of copying it. The memory must be registered with memory_manager.
+    const void * borrowed = borrow_binary(ar, bit_data_size() * sizeof(uint64_t), 0);
+    if (borrowed != nullptr)
+    {
+        memory_manager::free_mem(m_data);
+        m_data = (uint64_t *)borrowed;
+        m_capacity = bit_data_size() << 6;
+        return;
+    }
     resize(size());
     ar(cereal::make_nvp("data", cereal::binary_data(m_data, bit_data_size() * sizeof(uint64_t))));
 }
@@ -9,7 +9,12 @@
 #define INCLUDED_SDSL_MEMORY_MANAGEMENT
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstring>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 #include <sdsl/bits.hpp>
 #include <sdsl/config.hpp>
@@ -770,6 +775,10 @@ class memory_manager
 {
   private:
     bool hugepages = false;
+    // Memory regions owned by someone else, e.g. file mappings, which int_vectors may point into.
+    std::mutex borrowed_mutex;
+    std::vector<std::pair<const char *, const char *>> borrowed;
+    std::atomic<size_t> n_borrowed{0};
 
   private:
     static memory_manager & the_manager()
@@ -778,7 +787,46 @@ class memory_manager
         return m;
     }
 
+    //! Returns the end of the borrowed region containing ptr, or nullptr if ptr is not borrowed.
+    static const char * borrowed_end(const void * ptr)
+    {
+        auto & m = the_manager();
+        if (ptr == nullptr or m.n_borrowed.load() == 0) return nullptr;
+        std::lock_guard<std::mutex> lock(m.borrowed_mutex);
+        for (const auto & region : m.borrowed)
+        {
+            if (region.first <= (const char *)ptr and (const char *)ptr < region.second) return region.second;
+        }
+        return nullptr;
+    }
+
   public:
+    //! Registers memory that is owned elsewhere, e.g. a read-only file mapping.
+    /*! int_vectors whose data points into a registered region never free it and copy it
+     *  to newly allocated memory before it is resized.
+     */
+    static void register_borrowed(const void * begin, size_t size_in_bytes)
+    {
+        auto & m = the_manager();
+        std::lock_guard<std::mutex> lock(m.borrowed_mutex);
+        m.borrowed.emplace_back((const char *)begin, (const char *)begin + size_in_bytes);
+        m.n_borrowed = m.borrowed.size();
+    }
+
+    //! Removes a region registered by register_borrowed.
+    static void unregister_borrowed(const void * begin)
+    {
+        auto & m = the_manager();
+        std::lock_guard<std::mutex> lock(m.borrowed_mutex);
+        m.borrowed.erase(std::remove_if(m.borrowed.begin(),
+                                        m.borrowed.end(),
+                                        [begin](const std::pair<const char *, const char *> & region) {
+                                            return region.first == (const char *)begin;
+                                        }),
+                         m.borrowed.end());
+        m.n_borrowed = m.borrowed.size();
+    }
+
     static uint64_t * alloc_mem(size_t size_in_bytes)
     {
 #ifndef _WIN32
@@ -789,6 +837,7 @@ class memory_manager
     }
     static void free_mem(uint64_t * ptr)
     {
+        if (borrowed_end(ptr) != nullptr) return;
 #ifndef _WIN32
         auto & m = the_manager();
         if (m.hugepages and hugepage_allocator::the_allocator().in_address_space(ptr))
@@ -801,6 +850,13 @@ class memory_manager
     }
     static uint64_t * realloc_mem(uint64_t * ptr, size_t size)
     {
+        if (const char * end = borrowed_end(ptr))
+        {
+            uint64_t * copy = alloc_mem(size);
+            if (copy != nullptr)
+                memcpy(copy, ptr, std::min<size_t>(size, end - (const char *)ptr));
+            return copy;
+        }
 #ifndef _WIN32
         auto & m = the_manager();
         if (m.hugepages and hugepage_allocator::the_allocator().in_address_space(ptr))
@@ -125,6 +125,17 @@ class rank_support_v : public rank_support
             return *p + ((*(p + 1) >> (63 - 9 * ((idx & 0x1FF) >> 6))) & 0x1FF);
     }
 
+    //! Prefetches the memory read by rank(idx) into the cache
+    void prefetch(size_type idx) const
+    {
+#if defined(__GNUC__)
+        __builtin_prefetch(m_basic_block.data() + ((idx >> 8) & 0xFFFFFFFFFFFFFFFEULL));
+        __builtin_prefetch(m_v->data() + (idx >> 6));
+#else
+        (void)idx;
+#endif
+    }
+
     inline size_type operator()(size_type idx) const { return rank(idx); }
 
     size_type size() const { return m_v->size(); }
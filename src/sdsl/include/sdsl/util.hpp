@@ -347,7 +347,7 @@ inline char * str_from_errno()
 
 struct _id_helper_struct
 {
-    uint64_t id = 0;
+    std::atomic<uint64_t> id{0};
 };
 
 extern inline uint64_t _id_helper()
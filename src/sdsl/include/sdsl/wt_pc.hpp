@@ -9,11 +9,15 @@
 #ifndef INCLUDED_SDSL_WT_PC
 #define INCLUDED_SDSL_WT_PC
 
+#include <algorithm>
+#include <thread>
 #include <tuple>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
 #include <sdsl/bit_vectors.hpp>
+#include <sdsl/construct_config.hpp>
 #include <sdsl/rank_support.hpp>
 #include <sdsl/select_support.hpp>
 #include <sdsl/wt_helper.hpp>
@@ -22,6 +26,19 @@
 namespace sdsl
 {
 
+//! Iterators that several threads may read through at the same time.
+template <typename t_it>
+struct is_concurrent_iterator : std::is_pointer<t_it>
+{};
+
+template <class t_int_vector>
+struct is_concurrent_iterator<int_vector_iterator<t_int_vector>> : std::true_type
+{};
+
+template <class t_int_vector>
+struct is_concurrent_iterator<int_vector_const_iterator<t_int_vector>> : std::true_type
+{};
+
 //! A prefix code-shaped wavelet.
 /*!
  * \tparam t_shape       Shape of the tree ().
@@ -77,6 +94,17 @@ class wt_pc
     select_0_type m_bv_select0;
     tree_strat_type m_tree;
 
+    // prefetches the data rank support t_rs reads for rank(i), if it
+    // supports prefetching
+    template <class t_rs>
+    static auto prefetch_rank(const t_rs & rs, size_type i, int) -> decltype(rs.prefetch(i), void())
+    {
+        rs.prefetch(i);
+    }
+    template <class t_rs>
+    static void prefetch_rank(const t_rs &, size_type, long)
+    {}
+
     // insert a character into the wavelet tree, see construct method
     void insert_char(value_type old_chr, std::vector<uint64_t> & bv_node_pos, size_type times, bit_vector & bv)
     {
@@ -104,13 +132,191 @@ class wt_pc
         return bv_size;
     }
 
-    void construct_init_rank_select()
+    void construct_init_rank_select(uint32_t n_threads = 1)
     {
+        if (n_threads > 1)
+        { // the supports only read m_bv, so they can be built side by side
+            std::thread select0([this]() { util::init_support(m_bv_select0, &m_bv); });
+            std::thread select1([this]() { util::init_support(m_bv_select1, &m_bv); });
+            util::init_support(m_bv_rank, &m_bv);
+            select0.join();
+            select1.join();
+            return;
+        }
         util::init_support(m_bv_rank, &m_bv);
         util::init_support(m_bv_select0, &m_bv);
         util::init_support(m_bv_select1, &m_bv);
     }
 
+    // Fills the wavelet tree bit sequence in one pass over the input
+    template <typename t_it>
+    void construct_bv(t_it begin, t_it end, bit_vector & temp_bv)
+    {
+        // Initializing starting position of wavelet tree nodes
+        std::vector<uint64_t> bv_node_pos(m_tree.size(), 0);
+        for (size_type v = 0; v < m_tree.size(); ++v) { bv_node_pos[v] = m_tree.bv_pos(v); }
+        value_type old_chr = *begin;
+        uint32_t times = 0;
+        for (auto it = begin; it != end; ++it)
+        {
+            value_type chr = *it;
+            if (chr != old_chr)
+            {
+                insert_char(old_chr, bv_node_pos, times, temp_bv);
+                times = 1;
+                old_chr = chr;
+            }
+            else
+            { // chr == old_chr
+                ++times;
+                if (times == 64)
+                {
+                    insert_char(old_chr, bv_node_pos, times, temp_bv);
+                    times = 0;
+                }
+            }
+        }
+        if (times > 0) { insert_char(old_chr, bv_node_pos, times, temp_bv); }
+    }
+
+    // Minimum number of symbols per block of the parallel construction
+    static const size_type min_block_size = 4096;
+
+    // Number of blocks the input is split into by the parallel construction
+    template <typename t_it>
+    static uint32_t construct_blocks(size_type n)
+    {
+        if (!is_concurrent_iterator<t_it>::value) return 1;
+        return std::max<size_type>(std::min<size_type>(construct_threads(), n / min_block_size), 1);
+    }
+
+    // Start of block b of n_blocks in the input of size n
+    static size_type block_begin(size_type n, uint32_t n_blocks, uint32_t b)
+    {
+        return n / n_blocks * b + std::min<size_type>(n % n_blocks, b);
+    }
+
+    // Counts the characters of each block in parallel, C_block[b][c] is the
+    // number of occurrences of c in block b and C the total.
+    template <typename t_it>
+    void calculate_block_occurences(t_it begin,
+                                    uint32_t n_blocks,
+                                    std::vector<std::vector<size_type>> & C_block,
+                                    std::vector<size_type> & C)
+    {
+        C_block.assign(n_blocks, std::vector<size_type>());
+        std::vector<std::thread> threads;
+        for (uint32_t b = 0; b < n_blocks; ++b)
+        {
+            threads.emplace_back([&, b]() {
+                calculate_character_occurences(begin + block_begin(m_size, n_blocks, b),
+                                               begin + block_begin(m_size, n_blocks, b + 1),
+                                               C_block[b]);
+            });
+        }
+        for (auto & thread : threads) thread.join();
+        C.clear();
+        for (auto & C_b : C_block)
+        {
+            if (C_b.size() > C.size()) C.resize(C_b.size(), 0);
+            for (size_type c = 0; c < C_b.size(); ++c) C[c] += C_b[c];
+        }
+    }
+
+    // Fills the wavelet tree bit sequence with one thread per block. Within
+    // each node, the bits of block b directly follow those of block b-1, so
+    // every block writes to its own segment of each node. Words that a
+    // segment shares with its neighbours are collected per thread and
+    // combined after all threads are done.
+    template <typename t_it>
+    void construct_bv_blocks(t_it begin, const std::vector<std::vector<size_type>> & C_block, bit_vector & bv)
+    {
+        const uint32_t n_blocks = C_block.size();
+        const size_type n_nodes = m_tree.size();
+        // node_begin[b][v] is the position of the first bit of block b in node v
+        std::vector<std::vector<uint64_t>> node_begin(n_blocks + 1, std::vector<uint64_t>(n_nodes, 0));
+        for (size_type v = 0; v < n_nodes; ++v) { node_begin[0][v] = m_tree.bv_pos(v); }
+        for (uint32_t b = 0; b < n_blocks; ++b)
+        {
+            node_begin[b + 1] = node_begin[b];
+            for (size_type c = 0; c < C_block[b].size(); ++c)
+            {
+                if (C_block[b][c] == 0) continue;
+                uint64_t p = m_tree.bit_path(c);
+                uint32_t path_len = p >> 56;
+                node_type v = m_tree.root();
+                for (uint32_t l = 0; l < path_len; ++l, p >>= 1)
+                {
+                    node_begin[b + 1][v] += C_block[b][c];
+                    v = m_tree.child(v, p & 1);
+                }
+            }
+        }
+
+        // shared[b] holds the head and tail word masks of the segments of block b
+        std::vector<std::vector<uint64_t>> shared(n_blocks, std::vector<uint64_t>(2 * n_nodes, 0));
+        uint64_t * data = bv.data();
+        std::vector<std::thread> threads;
+        for (uint32_t b = 0; b < n_blocks; ++b)
+        {
+            threads.emplace_back([&, b]() {
+                std::vector<uint64_t> pos = node_begin[b];
+                std::vector<uint64_t> & masks = shared[b];
+                auto set_word = [&](node_type v, uint64_t word, uint64_t mask) {
+                    if (word == (node_begin[b][v] >> 6))
+                        masks[2 * v] |= mask;
+                    else if (word == ((node_begin[b + 1][v] - 1) >> 6))
+                        masks[2 * v + 1] |= mask;
+                    else
+                        data[word] |= mask;
+                };
+                auto insert = [&](value_type chr, uint32_t times) {
+                    uint64_t p = m_tree.bit_path(chr);
+                    uint32_t path_len = p >> 56;
+                    node_type v = m_tree.root();
+                    for (uint32_t l = 0; l < path_len; ++l, p >>= 1)
+                    {
+                        if (p & 1)
+                        {
+                            uint64_t ones = bits::lo_set[times];
+                            uint64_t offset = pos[v] & 0x3F;
+                            set_word(v, pos[v] >> 6, ones << offset);
+                            if (offset + times > 64) { set_word(v, (pos[v] >> 6) + 1, ones >> (64 - offset)); }
+                        }
+                        pos[v] += times;
+                        v = m_tree.child(v, p & 1);
+                    }
+                };
+                auto it = begin + block_begin(m_size, n_blocks, b);
+                auto end = begin + block_begin(m_size, n_blocks, b + 1);
+                value_type old_chr = *it;
+                uint32_t times = 0;
+                for (; it != end; ++it)
+                {
+                    value_type chr = *it;
+                    if (chr != old_chr or times == 64)
+                    {
+                        insert(old_chr, times);
+                        times = 0;
+                        old_chr = chr;
+                    }
+                    ++times;
+                }
+                insert(old_chr, times);
+            });
+        }
+        for (auto & thread : threads) thread.join();
+        for (uint32_t b = 0; b < n_blocks; ++b)
+        {
+            for (size_type v = 0; v < n_nodes; ++v)
+            {
+                if (node_begin[b + 1][v] == node_begin[b][v]) continue;
+                data[node_begin[b][v] >> 6] |= shared[b][2 * v];
+                data[(node_begin[b + 1][v] - 1) >> 6] |= shared[b][2 * v + 1];
+            }
+        }
+    }
+
     // recursive internal version of the method interval_symbols
     void _interval_symbols(size_type i,
                            size_type j,
@@ -170,48 +376,35 @@ class wt_pc
       : m_size(std::distance(begin, end))
     {
         if (0 == m_size) return;
+        // Inputs in memory are split into blocks processed in parallel, if
+        // construct_config().n_threads allows for more than one thread
+        const uint32_t n_blocks = construct_blocks<t_it>(m_size);
         // O(n + |\Sigma|\log|\Sigma|) algorithm for calculating node sizes
         // TODO: C should also depend on the tree_strategy. C is just a mapping
         // from a symbol to its frequency. So a map<uint64_t,uint64_t> could be
         // used for integer alphabets...
         std::vector<size_type> C;
+        std::vector<std::vector<size_type>> C_block;
         // 1. Count occurrences of characters
-        calculate_character_occurences(begin, end, C);
+        if (n_blocks > 1) { calculate_block_occurences(begin, n_blocks, C_block, C); }
+        else
+        {
+            calculate_character_occurences(begin, end, C);
+        }
         // 2. Calculate effective alphabet size
         calculate_effective_alphabet_size(C, m_sigma);
         // 3. Generate tree shape
         size_type tree_size = construct_tree_shape(C);
         // 4. Generate wavelet tree bit sequence m_bv
         bit_vector temp_bv(tree_size, 0);
-
-        // Initializing starting position of wavelet tree nodes
-        std::vector<uint64_t> bv_node_pos(m_tree.size(), 0);
-        for (size_type v = 0; v < m_tree.size(); ++v) { bv_node_pos[v] = m_tree.bv_pos(v); }
-        value_type old_chr = *begin;
-        uint32_t times = 0;
-        for (auto it = begin; it != end; ++it)
+        if (n_blocks > 1) { construct_bv_blocks(begin, C_block, temp_bv); }
+        else
         {
-            value_type chr = *it;
-            if (chr != old_chr)
-            {
-                insert_char(old_chr, bv_node_pos, times, temp_bv);
-                times = 1;
-                old_chr = chr;
-            }
-            else
-            { // chr == old_chr
-                ++times;
-                if (times == 64)
-                {
-                    insert_char(old_chr, bv_node_pos, times, temp_bv);
-                    times = 0;
-                }
-            }
+            construct_bv(begin, end, temp_bv);
         }
-        if (times > 0) { insert_char(old_chr, bv_node_pos, times, temp_bv); }
         m_bv = bit_vector_type(std::move(temp_bv));
         // 5. Initialize rank and select data structures for m_bv
-        construct_init_rank_select();
+        construct_init_rank_select(n_blocks);
         // 6. Finish inner nodes by precalculating the bv_pos_rank values
         m_tree.init_node_ranks(m_bv_rank);
     }
@@ -359,6 +552,65 @@ class wt_pc
         return result;
     };
 
+    //! Calculates rank(i[k], c[k]) for all k < n and stores it in result[k].
+    /*!
+     * \param i Exclusive right bounds of the prefixes.
+     * \param c Symbols.
+     * \param result Number of occurrences of c[k] in the prefix [0..i[k]-1].
+     * \param n Number of queries.
+     * \par Time complexity
+     *      \f$ \Order{n H_0} \f$ on average, like n calls of rank()
+     *
+     * Queries descend the tree in lockstep, up to 64 at a time. On every
+     * level, the rank data of all queries is prefetched before the first
+     * of them reads it, so that their cache misses overlap instead of
+     * being waited for one after the other.
+     */
+    void rank_batch(const size_type * i, const value_type * c, size_type * result, size_type n) const
+    {
+        const size_type width = 64;
+        uint64_t paths[width];
+        uint32_t lengths[width];
+        node_type nodes[width];
+        for (size_type begin = 0; begin < n; begin += width)
+        {
+            const size_type m = std::min(width, n - begin);
+            size_type * r = result + begin;
+            for (size_type k = 0; k < m; ++k)
+            {
+                r[k] = i[begin + k];
+                lengths[k] = 0;
+                if (!m_tree.is_valid(m_tree.c_to_leaf(c[begin + k])))
+                    r[k] = 0; // if `c` was not in the text
+                else if (m_sigma > 1)
+                {
+                    paths[k] = m_tree.bit_path(c[begin + k]);
+                    lengths[k] = paths[k] >> 56;
+                    nodes[k] = m_tree.root();
+                }
+            }
+            bool descending = true;
+            while (descending)
+            {
+                for (size_type k = 0; k < m; ++k)
+                {
+                    if (lengths[k] > 0 and r[k]) prefetch_rank(m_bv_rank, m_tree.bv_pos(nodes[k]) + r[k], 0);
+                }
+                descending = false;
+                for (size_type k = 0; k < m; ++k)
+                {
+                    if (lengths[k] == 0 or !r[k]) continue;
+                    const node_type v = nodes[k];
+                    const size_type ones = m_bv_rank(m_tree.bv_pos(v) + r[k]) - m_tree.bv_pos_rank(v);
+                    r[k] = (paths[k] & 1) ? ones : r[k] - ones;
+                    nodes[k] = m_tree.child(v, paths[k] & 1);
+                    paths[k] >>= 1;
+                    descending |= --lengths[k] > 0;
+                }
+            }
+        }
+    };
+
     //! Calculates how many times symbol wt[i] occurs in the prefix [0..i-1].
     /*!
      * \param i The index of the symbol.
@@ -390,6 +642,54 @@ class wt_pc
         return std::make_pair(i, (value_type)m_tree.bv_pos_rank(v));
     }
 
+    //! Calculates inverse_select(i[k]) for all k < n and stores it in result[k].
+    /*!
+     * \param i Indices of the symbols.
+     * \param result Pairs (rank(wt[i[k]],i[k]),wt[i[k]]).
+     * \param n Number of queries.
+     * \par Time complexity
+     *      \f$ \Order{n H_0} \f$ on average, like n calls of inverse_select()
+     *
+     * Queries descend the tree in lockstep like in rank_batch().
+     */
+    void inverse_select_batch(const size_type * i, std::pair<size_type, value_type> * result, size_type n) const
+    {
+        const size_type width = 64;
+        node_type nodes[width];
+        for (size_type begin = 0; begin < n; begin += width)
+        {
+            const size_type m = std::min(width, n - begin);
+            auto * r = result + begin;
+            for (size_type k = 0; k < m; ++k)
+            {
+                r[k].first = i[begin + k];
+                nodes[k] = m_tree.root();
+            }
+            bool descending = !m_tree.is_leaf(m_tree.root());
+            while (descending)
+            {
+                for (size_type k = 0; k < m; ++k)
+                {
+                    if (!m_tree.is_leaf(nodes[k])) prefetch_rank(m_bv_rank, m_tree.bv_pos(nodes[k]) + r[k].first, 0);
+                }
+                descending = false;
+                for (size_type k = 0; k < m; ++k)
+                {
+                    const node_type v = nodes[k];
+                    if (m_tree.is_leaf(v)) continue;
+                    const size_type pos = m_tree.bv_pos(v) + r[k].first;
+                    const bool bit = m_bv[pos];
+                    const size_type ones = m_bv_rank(pos) - m_tree.bv_pos_rank(v);
+                    r[k].first = bit ? ones : r[k].first - ones;
+                    nodes[k] = m_tree.child(v, bit);
+                    descending |= !m_tree.is_leaf(nodes[k]);
+                }
+            }
+            // if v is a leaf bv_pos_rank returns symbol itself
+            for (size_type k = 0; k < m; ++k) r[k].second = (value_type)m_tree.bv_pos_rank(nodes[k]);
+        }
+    }
+
     //! Calculates the ith occurrence of the symbol c in the supported vector.
     /*!
      * \param i The ith occurrence.
@@ -356,6 +356,24 @@ class wt_rlmn
         }
     }
 
+    //! Number of runs of equal symbols in the sequence.
+    size_type runs() const { return m_wt.size(); }
+
+    //! Index of the run of equal symbols containing position i, counting
+    //! runs from 0.
+    size_type run(size_type i) const
+    {
+        assert(i < size());
+        return m_bl_rank(i + 1) - 1;
+    }
+
+    //! Position of the first symbol of run r, counting runs from 0.
+    size_type run_begin(size_type r) const
+    {
+        assert(r < runs());
+        return m_bl_select(r + 1);
+    }
+
     //! Calculates the ith occurrence of the symbol c in the supported vector.
     /*!
      *  \param i The ith occurrence. \f$i\in [1..rank(size(),c)]\f$.
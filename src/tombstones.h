@@ -0,0 +1,69 @@
+#ifndef FM_INDEX_TOMBSTONES_H
+#define FM_INDEX_TOMBSTONES_H
+
+#include <vector>
+
+#include <sdsl/int_vector.hpp>
+
+// Deleted corpus strings of a segment, marked in a bit vector over its
+// strings. Deleted strings keep their corpus string index. Their text stays
+// in the index, and hits in them are filtered from results, until the
+// segment is rebuilt without it.
+class Tombstones {
+public:
+  using size_type = sdsl::bit_vector::size_type;
+  Tombstones() {};
+  // No string deleted yet
+  explicit Tombstones(size_type n_documents) : deleted(n_documents, 0) {};
+  // Concatenation of the tombstones of consecutive segments
+  explicit Tombstones(const std::vector<const Tombstones*>& parts);
+  // Number of corpus strings
+  size_type size() const { return deleted.size(); };
+  bool is_deleted(size_type doc) const { return deleted[doc]; };
+  size_type n_deleted() const { return n_deleted_; };
+  // Length of the text of deleted strings still in the index. Hits need to
+  // be filtered unless it is 0.
+  size_type pending_size() const { return pending_size_; };
+  // Marks doc as deleted, length is the length of its text still in the
+  // index
+  void erase(size_type doc, size_type length) {
+    if (deleted[doc])
+      return;
+    deleted[doc] = 1;
+    n_deleted_++;
+    pending_size_ += length;
+  };
+  template<class Archive>
+  void save(Archive& archive) const {
+    archive(deleted, n_deleted_, pending_size_);
+  };
+  // Always copied, even from a memory-mapped file, as deleting strings
+  // modifies a copy of the tombstones in memory
+  template<class Archive>
+  void load(Archive& archive) {
+    sdsl::bit_vector loaded;
+    archive(loaded, n_deleted_, pending_size_);
+    deleted = loaded;
+  };
+private:
+  sdsl::bit_vector deleted;
+  size_type n_deleted_ = 0;
+  size_type pending_size_ = 0;
+};
+
+inline Tombstones::Tombstones(const std::vector<const Tombstones*>& parts) {
+  size_type size = 0;
+  for (const auto* part: parts)
+    size += part->size();
+  deleted = sdsl::bit_vector(size, 0);
+  size_type offset = 0;
+  for (const auto* part: parts) {
+    for (size_type doc = 0; doc < part->size(); doc++)
+      deleted[offset + doc] = part->deleted[doc];
+    offset += part->size();
+    n_deleted_ += part->n_deleted_;
+    pending_size_ += part->pending_size_;
+  }
+}
+
+#endif